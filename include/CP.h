@@ -15,13 +15,41 @@
 #define _CP_H_
 
 #include <vector>
+#include <algorithm>
+#include <climits>
+#include <type_traits>
 #include "vec.h"
 #include "sos_utils.h"
+#include "stencil.h"
+#include "cells.h"
+#include "parallel.h"
 
+// -----------------------------------------------------------------------
+// T is the scalar type of the vector field (float or double). the values keep
+// their type through the filter, and are widened only when quantized for SoS.
+//
+// SoS is loaded lazily: the simplices are filtered first, and only the
+// vertices of those that pass the filter are loaded, as consecutive rows in
+// the order of their ids. since SoS depends only on the order of the rows,
+// the result is the same as for loading all vertices, while the time and the
+// memory of SoS scale with the candidates instead of the data.
+//
+// SoS indexes its matrix with int, so one detector handles at most
+// MAX_VERTICES vertices. larger grids are detected in blocks (or slabs), each
+// with its own detector on a range of the vertices; the local vertex and
+// simplex ids of a block fit in 32 bits, and only the global simplex ids of
+// the output need 64 bits.
+// -----------------------------------------------------------------------
+template <typename T>
 class CPDetector{
 
+public:
+    typedef Vec<3,T> value_type;
+
+private:
     unsigned int dim;
-    const std::vector<vec> *vfield;   // vector field
+    const value_type *vfield;         // vector field
+    size_t nverts;                    // number of vertices in vfield
     const std::vector<ivec4> *tets;   // tets
     const std::vector<ivec3> *tris;   // tets
 
@@ -29,31 +57,540 @@ class CPDetector{
 
 
     unsigned int SOS_ZERO_IDX = 1;  // index assigned to zero value!
-    bool createSoS(bool verbose = false);
+
+    // vectors detected instead of zero (if any). they are the last rows of SoS,
+    // from SOS_ZERO_IDX on, and cp_targets[k] gets the simplices that contain targets[k]
+    std::vector<point> targets;
+    std::vector<std::vector<size_t> > cp_targets;
+
+    // exact test for the simplex v and the SoS row p of zero or a target, which is the point q without SoS
+    template <typename I>
+    bool contains(const I *v, unsigned int p, const point &q) const;
+
+    // filter the simplices of the grid for all targets together, and test the candidates of every target
+    template <typename Stencil>
+    void compute_targets(const StructuredGrid<Stencil> &grid);
+
+    // load the vertices marked in used (all if null) into SoS
+    bool createSoS(const std::vector<uint8_t> *used = 0, bool verbose = false);
+    bool sos_loaded = false;
+
+    // SoS row of every vertex (0 if not loaded), or empty if vertex v is row v+1
+    std::vector<int> sos_row;
+    int row(size_t v) const {   return sos_row.empty() ? int(v)+1 : sos_row[v];   }
+
+    template <typename I>
+    static void mark(std::vector<uint8_t> &used, const I *v, int n) {
+        for(int i = 0; i < n; i++)
+            used[v[i]] = 1;
+    }
+
+    // filter the n simplices given by simplex(i) (a pointer to their N vertex
+    // ids), load the vertices of the candidates, and test the candidates
+    template <int N, typename F>
+    void compute_simplices(size_t n, F simplex);
+
+    // skip simplices that cannot contain zero, before the exact test
+    bool filter = true;
+
+    // do not print progress
+    bool quiet = false;
+
+    // in 2D, rank of every SoS index in the SoS order of the y components
+    // (empty if not available). replaces sos_smaller in the halfline tests
+    bool ranks = true;
+    std::vector<int> sos_rank;
+    void create_ranks(const std::vector<double> &yvalues);
+
+    int intersect_halfline(int vi, int vj, int vk) const {
+        return sos_rank.empty() ? SoSUtils::intersect_halfline(vi, vj, vk) :
+                                  SoSUtils::intersect_halfline(vi, vj, vk, sos_rank.data());
+    }
+
+    // in 2D, test each edge once and accumulate the crossing parity into its triangles
+    bool edge_sweep = true;
+    void compute_edge_sweep();
+    void compute_edge_sweep(const StructuredGrid<Tri2> &grid);
+
+    // cells per axis of the tiles in which structured grids are traversed (0: no
+    // tiles). if empty, cubic tiles whose vertex values fill half of the L2 cache
+    std::vector<size_t> tile;
+    void tile_size(size_t t[3]) const;
+
+    // collect the simplices of the grid that pass the filter, tile by tile
+    template <typename Stencil>
+    void filter_tiled(const StructuredGrid<Stencil> &grid, const size_t t[3], std::vector<size_t> &candidates) const;
 
 public:
-    CPDetector(const std::vector<vec> *vfield_, std::vector<ivec4> *tets_) :
-        dim(3), vfield(vfield_), tets(tets_), tris(0) {
+    // values are loaded into SoS as fixed-point numbers with SOS_FIX_A decimals
+    static constexpr int SOS_FIX_W = 15;
+    static constexpr int SOS_FIX_A = 14;
+    static constexpr double SOS_EPS = 1e-14;    // 10^-SOS_FIX_A
 
-        createSoS();
+    // the SoS matrix has a row per vertex and one for zero, and its stack
+    // holds a number per entry, both indexed with int
+    static constexpr size_t MAX_VERTICES = size_t(INT_MAX)/3 - 2;
+
+    // cheap filter: a simplex cannot contain zero if, for some component, the
+    // values at all its vertices are at least SOS_EPS away from zero on the same
+    // side, since they keep their sign after quantization and perturbation
+    template <typename V, typename I>
+    static bool may_contain_zero(const std::vector<V> &vfield, const I *v, int nverts, int dim) {
+        return may_contain_zero(vfield.data(), v, nverts, dim);
     }
 
-    CPDetector(const std::vector<vec> *vfield_, std::vector<ivec3> *tris_) :
-        dim(2), vfield(vfield_), tets(0), tris(tris_) {
+    template <typename V, typename I>
+    static bool may_contain_zero(const V *vfield, const I *v, int nverts, int dim) {
 
-        createSoS();
+        for(int d = 0; d < dim; d++){
+
+            bool pos = true, neg = true;
+            for(int i = 0; i < nverts; i++){
+                const double val = vfield[v[i]][d];
+                pos = pos && (val >= SOS_EPS);
+                neg = neg && (val <= -SOS_EPS);
+            }
+            if(pos || neg)
+                return false;
+        }
+        return true;
+    }
+
+    CPDetector(const std::vector<value_type> *vfield_, std::vector<ivec4> *tets_) :
+        dim(3), vfield(vfield_->data()), nverts(vfield_->size()), tets(tets_), tris(0) {
+    }
+
+    CPDetector(const std::vector<value_type> *vfield_, std::vector<ivec3> *tris_) :
+        dim(2), vfield(vfield_->data()), nverts(vfield_->size()), tets(0), tris(tris_) {
+    }
+
+    // for structured grids, the simplices are created on the fly by compute(grid)
+    CPDetector(const std::vector<value_type> *vfield_, unsigned int dim_) :
+        dim(dim_), vfield(vfield_->data()), nverts(vfield_->size()), tets(0), tris(0) {
+    }
+
+    // the nverts_ vertices starting at vfield_, e.g., a slab of a grid that is too large for one detector
+    CPDetector(const value_type *vfield_, size_t nverts_, unsigned int dim_) :
+        dim(dim_), vfield(vfield_), nverts(nverts_), tets(0), tris(0) {
     }
 
     ~CPDetector() {
-        sos_shutdown();
+        if(sos_loaded)
+            sos_shutdown();
     }
 
     static float sign (const point &p1, const point &p2, const point &p3);
     static bool point_in_triangle(const point &p, const point &a, const point &b, const point &c);
     static bool point_in_tetrahedron(const point &p, const point &a, const point &b, const point &c, const point &d);
 
+    void use_edge_sweep(bool v) {   edge_sweep = v; }
+    void use_filter(bool v) {       filter = v;     }
+    void use_tiles(const std::vector<size_t> &t) {  tile = t;   }
+    void use_ranks(bool v) {        ranks = v;      }
+    void set_quiet(bool v) {        quiet = v;      }
+
+    // detect where the field equals any of the given vectors, instead of zero
+    // (only for structured grids). a target is tested exactly as zero in the
+    // field minus the target, but every vertex is loaded once for all targets
+    void set_targets(const std::vector<point> &t) {     targets = t;    }
+
+    // load the vertices marked in used (all if null) into SoS. the compute
+    // functions load the vertices they need, but contains_zero does not
+    void load(const std::vector<uint8_t> *used = 0) {   createSoS(used);    }
+
+    // exact test for the simplex given by the (0-based) ids of its dim+1 vertices,
+    // which must be loaded
+    template <typename I>
+    bool contains_zero(const I *v) const;
+
     void compute();
+
+    // cells are split into simplices on the fly. the cp of the k-th simplex
+    // of cell c is reported as c*Cells::MAX_SIMPLICES + k
+    void compute(const MixedMesh &mesh);
+
+    template <typename Stencil>
+    void compute(const StructuredGrid<Stencil> &grid);
+
+    // test only the given simplices of the grid (e.g., those that passed the filter),
+    // loading only their vertices. I is the type of their local ids
+    template <typename Stencil, typename I>
+    void compute(const StructuredGrid<Stencil> &grid, const std::vector<I> &candidates);
+
     const std::vector<size_t>& get_CP() const {   return cp;  }
+    const std::vector<size_t>& get_CP(size_t target) const {   return cp_targets[target];  }
 
 };
+
+// -----------------------------------------------------------------------
+// the vertex ids of a cell are computed once and shared by all its simplices.
+// the loop over the simplices of a cell has a compile-time trip count.
+// the simplices that pass the filter are collected first, and only their
+// vertices are loaded into SoS before the exact tests
+template <typename T>
+template <typename Stencil>
+void CPDetector<T>::compute(const StructuredGrid<Stencil> &grid) {
+
+    if(!quiet){
+        printf("\n Detecting %dD Critical Points..", this->dim);
+        fflush(stdout);
+    }
+
+    if(dim != Stencil::dim){
+        std::cerr << " CPDetector::compute -- grid stencil does not match dimensionality " << dim << std::endl;
+        return;
+    }
+
+    if(!targets.empty()){
+        compute_targets(grid);
+        return;
+    }
+
+    if constexpr (std::is_same<Stencil, Tri2>::value) {
+        if(edge_sweep) {
+            compute_edge_sweep(grid);
+            if(!quiet)
+                printf(" Detected %ld simplices with critical points!\n", cp.size());
+            return;
+        }
+    }
+
+    // without the filter, every simplex is tested
+    if(!filter){
+
+        createSoS();
+        grid.for_each_cell([this](size_t c, const size_t *v, int p) {
+
+            const int (&S)[Stencil::nsimplices][Stencil::dim+1] = Stencil::simplices[p];
+
+            for(int k = 0; k < Stencil::nsimplices; k++){
+
+                size_t s[Stencil::dim+1];
+                for(int i = 0; i <= Stencil::dim; i++)
+                    s[i] = v[S[k][i]];
+
+                if(contains_zero(s)){
+                    cp.push_back(c*Stencil::nsimplices + k);
+                }
+            }
+        });
+        if(!quiet)
+            printf(" Detected %ld simplices with critical points!\n", cp.size());
+        return;
+    }
+
+    std::vector<size_t> candidates;
+
+    size_t t[3];
+    tile_size(t);
+    if(t[0] > 0 && t[1] > 0 && t[2] > 0 &&
+       (t[0] < grid.num_cells(0) || t[1] < grid.num_cells(1) || t[2] < grid.num_cells(2))){
+
+        filter_tiled(grid, t, candidates);
+    }
+    else {
+        // the threads filter consecutive parts of the layers of cells, and
+        // their candidates are concatenated in order
+        const size_t nlayers = grid.num_cells(Stencil::dim-1);
+        const int nthreads = int(std::max(size_t(1), std::min(size_t(Parallel::num_threads()), nlayers)));
+        std::vector<std::vector<size_t> > parts (nthreads);
+
+        #pragma omp parallel for schedule(static) num_threads(nthreads)
+        for(int t = 0; t < nthreads; t++){
+
+            size_t lo, hi;
+            Parallel::part(nlayers, t, nthreads, lo, hi);
+            std::vector<size_t> &part = parts[t];
+
+            grid.for_each_cell([this, &part](size_t c, const size_t *v, int p) {
+
+                const int (&S)[Stencil::nsimplices][Stencil::dim+1] = Stencil::simplices[p];
+
+                for(int k = 0; k < Stencil::nsimplices; k++){
+
+                    size_t s[Stencil::dim+1];
+                    for(int i = 0; i <= Stencil::dim; i++)
+                        s[i] = v[S[k][i]];
+
+                    if(may_contain_zero(vfield, s, Stencil::dim+1, Stencil::dim))
+                        part.push_back(c*Stencil::nsimplices + k);
+                }
+            }, lo, hi);
+        }
+
+        for(int t = 0; t < nthreads; t++){
+            candidates.insert(candidates.end(), parts[t].begin(), parts[t].end());
+            std::vector<size_t>().swap(parts[t]);
+        }
+    }
+
+    compute(grid, candidates);
+    if(!quiet)
+        printf(" Detected %ld simplices with critical points! (%ld candidates)\n", cp.size(), candidates.size());
+}
+
+// the cells are visited one tile at a time. the values of the vertices of a
+// tile are first copied into one array per component, which the filter reads
+// with tile-local ids. hence, a vertex is read from the field once per tile
+// (plus the faces shared with the next tiles), and stays in cache while the
+// cells around it are filtered. the candidates are sorted, as for the
+// traversal of the whole grid
+template <typename T>
+template <typename Stencil>
+void CPDetector<T>::filter_tiled(const StructuredGrid<Stencil> &grid, const size_t t[3], std::vector<size_t> &candidates) const {
+
+    const size_t CX = grid.num_cells(0), CY = grid.num_cells(1), CZ = grid.num_cells(2);
+
+    // the threads take consecutive slabs of cell layers along the last axis (as
+    // in the untiled filter, and as the pages of the field are placed), and
+    // traverse their slab in tiles
+    const int axis = Stencil::dim-1;
+    const size_t nlayers = grid.num_cells(axis);
+    const int nthreads = int(std::max(size_t(1), std::min(size_t(Parallel::num_threads()), nlayers)));
+    std::vector<std::vector<size_t> > parts (nthreads);
+
+    #pragma omp parallel for schedule(static) num_threads(nthreads)
+    for(int th = 0; th < nthreads; th++){
+
+        size_t lo, hi;
+        Parallel::part(nlayers, th, nthreads, lo, hi);
+        const size_t zlo = (axis == 2) ? lo : 0, zhi = (axis == 2) ? hi : CZ;
+        const size_t ylo = (axis == 1) ? lo : 0, yhi = (axis == 1) ? hi : CY;
+
+        std::vector<size_t> &part = parts[th];
+        std::vector<T> soa[Stencil::dim];
+        size_t corners[Stencil::ncorners];
+        size_t local[Stencil::ncorners];
+
+        for(size_t z0 = zlo; z0 < zhi; z0 += t[2]){
+        for(size_t y0 = ylo; y0 < yhi; y0 += t[1]){
+        for(size_t x0 = 0; x0 < CX; x0 += t[0]){
+
+            const size_t x1 = std::min(x0 + t[0], CX), y1 = std::min(y0 + t[1], yhi), z1 = std::min(z0 + t[2], zhi);
+
+            // vertices of the tile
+            const size_t VX = x1-x0+1, VY = y1-y0+1, VZ = (Stencil::dim == 3) ? z1-z0+1 : 1;
+            for(int d = 0; d < Stencil::dim; d++)
+                soa[d].resize(VX*VY*VZ);
+
+            size_t l = 0;
+            for(size_t k = 0; k < VZ; k++){
+            for(size_t j = 0; j < VY; j++){
+            for(size_t i = 0; i < VX; i++, l++){
+                const value_type &val = vfield[grid.vertex(x0+i, y0+j, z0+k)];
+                for(int d = 0; d < Stencil::dim; d++)
+                    soa[d][l] = val[d];
+            }
+            }
+            }
+
+            // tile-local offsets of the corners of a cell
+            for(int c = 0; c < Stencil::ncorners; c++)
+                local[c] = (c&1) + VX*((c>>1)&1) + VX*VY*((c>>2)&1);
+
+            for(size_t slice = z0; slice < z1; slice++){
+            for(size_t row = y0; row < y1; row++){
+            for(size_t col = x0; col < x1; col++){
+
+                const int p = grid.cell_corners(col, row, slice, corners);
+                const size_t c = CX*(CY*slice + row) + col;
+                const size_t lc = (col-x0) + VX*((row-y0) + VY*(slice-z0));
+
+                const int (&S)[Stencil::nsimplices][Stencil::dim+1] = Stencil::simplices[p];
+
+                for(int k = 0; k < Stencil::nsimplices; k++){
+
+                    bool skip = false;
+                    for(int d = 0; !skip && d < Stencil::dim; d++){
+
+                        bool pos = true, neg = true;
+                        for(int i = 0; i <= Stencil::dim; i++){
+                            const double val = soa[d][lc + local[S[k][i]]];
+                            pos = pos && (val >= SOS_EPS);
+                            neg = neg && (val <= -SOS_EPS);
+                        }
+                        skip = pos || neg;
+                    }
+                    if(!skip)
+                        part.push_back(c*Stencil::nsimplices + k);
+                }
+            }
+            }
+            }
+        }
+        }
+        }
+    }
+
+    for(int th = 0; th < nthreads; th++){
+        candidates.insert(candidates.end(), parts[th].begin(), parts[th].end());
+        std::vector<size_t>().swap(parts[th]);
+    }
+    std::sort(candidates.begin(), candidates.end());
+}
+
+template <typename T>
+template <typename Stencil, typename I>
+void CPDetector<T>::compute(const StructuredGrid<Stencil> &grid, const std::vector<I> &candidates) {
+
+    if(dim != Stencil::dim){
+        std::cerr << " CPDetector::compute -- grid stencil does not match dimensionality " << dim << std::endl;
+        return;
+    }
+
+    std::vector<uint8_t> used (nverts, 0);
+    for(size_t i = 0; i < candidates.size(); i++){
+        const typename StructuredGrid<Stencil>::simplex_t s = grid[candidates[i]];
+        mark(used, &s[0], Stencil::dim+1);
+    }
+    createSoS(&used);
+
+    for(size_t i = 0; i < candidates.size(); i++){
+
+        const typename StructuredGrid<Stencil>::simplex_t s = grid[candidates[i]];
+        if(contains_zero(&s[0])){
+            cp.push_back(candidates[i]);
+        }
+    }
+}
+
+// the filter of a target c compares the range of every component over the
+// simplex to c. the range is computed once per simplex and shared by all
+// targets. the margin of 2*SOS_EPS covers the quantization of both the values
+// and the target, so that the filter rejects only simplices whose values stay
+// on one side of c in SoS. a candidate is stored as s*ntargets + k
+template <typename T>
+template <typename Stencil>
+void CPDetector<T>::compute_targets(const StructuredGrid<Stencil> &grid) {
+
+    const size_t K = targets.size();
+    const double margin = 2*SOS_EPS;
+
+    std::vector<size_t> candidates;
+    std::vector<uint8_t> used (nverts, 0);
+
+    grid.for_each_cell([&](size_t c, const size_t *v, int p) {
+
+        const int (&S)[Stencil::nsimplices][Stencil::dim+1] = Stencil::simplices[p];
+
+        for(int k = 0; k < Stencil::nsimplices; k++){
+
+            size_t s[Stencil::dim+1];
+            for(int i = 0; i <= Stencil::dim; i++)
+                s[i] = v[S[k][i]];
+
+            double lo[Stencil::dim], hi[Stencil::dim];
+            for(int d = 0; d < Stencil::dim; d++){
+                lo[d] = hi[d] = vfield[s[0]][d];
+                for(int i = 1; i <= Stencil::dim; i++){
+                    lo[d] = std::min(lo[d], double(vfield[s[i]][d]));
+                    hi[d] = std::max(hi[d], double(vfield[s[i]][d]));
+                }
+            }
+
+            bool any = false;
+            for(size_t m = 0; m < K; m++){
+
+                bool skip = false;
+                for(int d = 0; d < Stencil::dim; d++)
+                    skip = skip || (lo[d] - targets[m][d] >= margin) || (hi[d] - targets[m][d] <= -margin);
+
+                if(!skip){
+                    candidates.push_back((c*Stencil::nsimplices + k)*K + m);
+                    any = true;
+                }
+            }
+            if(any)
+                mark(used, s, Stencil::dim+1);
+        }
+    });
+    createSoS(&used);
+
+    cp_targets.assign(K, std::vector<size_t>());
+    for(size_t i = 0; i < candidates.size(); i++){
+
+        const size_t id = candidates[i] / K, m = candidates[i] % K;
+        const typename StructuredGrid<Stencil>::simplex_t s = grid[id];
+        if(contains(&s[0], SOS_ZERO_IDX + unsigned(m), targets[m]))
+            cp_targets[m].push_back(id);
+    }
+
+    if(!quiet){
+        size_t ncps = 0;
+        for(size_t m = 0; m < K; m++)
+            ncps += cp_targets[m].size();
+        printf(" Detected %ld simplices with critical points of %ld targets! (%ld candidates)\n", ncps, K, candidates.size());
+    }
+}
+
+template <typename T>
+template <int N, typename F>
+void CPDetector<T>::compute_simplices(size_t n, F simplex) {
+
+    if(!filter){
+        createSoS();
+        for(size_t t = 0; t < n; t++){
+            if(contains_zero(simplex(t)))
+                cp.push_back(t);
+        }
+        return;
+    }
+
+    // the threads filter consecutive parts of the simplices
+    const int nthreads = int(std::max(size_t(1), std::min(size_t(Parallel::num_threads()), n)));
+    std::vector<std::vector<size_t> > parts (nthreads);
+
+    #pragma omp parallel for schedule(static) num_threads(nthreads)
+    for(int th = 0; th < nthreads; th++){
+
+        size_t lo, hi;
+        Parallel::part(n, th, nthreads, lo, hi);
+        for(size_t t = lo; t < hi; t++){
+            if(may_contain_zero(vfield, simplex(t), N, N-1))
+                parts[th].push_back(t);
+        }
+    }
+
+    std::vector<size_t> candidates;
+    std::vector<uint8_t> used (nverts, 0);
+    for(int th = 0; th < nthreads; th++){
+        candidates.insert(candidates.end(), parts[th].begin(), parts[th].end());
+        std::vector<size_t>().swap(parts[th]);
+    }
+    for(size_t i = 0; i < candidates.size(); i++)
+        mark(used, simplex(candidates[i]), N);
+    createSoS(&used);
+
+    for(size_t i = 0; i < candidates.size(); i++){
+        if(contains_zero(simplex(candidates[i])))
+            cp.push_back(candidates[i]);
+    }
+}
+
+// -----------------------------------------------------------------------
+template <typename T>
+template <typename I>
+bool CPDetector<T>::contains_zero(const I *v) const {
+    return contains(v, SOS_ZERO_IDX, point(0,0,0));
+}
+
+template <typename T>
+template <typename I>
+bool CPDetector<T>::contains(const I *v, unsigned int p, const point &q) const {
+
+#ifdef USE_SOS
+    (void) q;
+    if(dim == 3)
+        return SoSUtils::point_in_tet(p, row(v[0]), row(v[1]), row(v[2]), row(v[3]));
+
+    return sos_rank.empty() ?
+                SoSUtils::point_in_triangle(p, row(v[0]), row(v[1]), row(v[2])) :
+                SoSUtils::point_in_triangle(p, row(v[0]), row(v[1]), row(v[2]), sos_rank.data());
+#else
+    if(dim == 3)
+        return point_in_tetrahedron(q, point(vfield[v[0]]), point(vfield[v[1]]), point(vfield[v[2]]), point(vfield[v[3]]));
+
+    return point_in_triangle(q, point(vfield[v[0]]), point(vfield[v[1]]), point(vfield[v[2]]));
+#endif
+}
 #endif
@@ -18,28 +18,271 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <cstdint>
+#include <cstdio>
 #include "vec.h"
+#include "stencil.h"
+#include "cells.h"
 
 namespace RW{
 
     int count_columns(const std::string &filename);
 
-    void read_text(std::vector<point> &points, std::vector<vec> &vfield, std::string filename, int vdim);
+    // the readers of regular grids are instantiated for vector fields of floats and doubles
+    template <typename T>
+    void read_text(std::vector<point> &points, std::vector<Vec<3,T> > &vfield, std::string filename, int vdim);
+
+    // append at most count points and vectors from an open stream. returns the number read
+    template <typename T>
+    size_t read_text(std::istream &infile, std::vector<point> &points, std::vector<Vec<3,T> > &vfield, int vdim, size_t count);
     void read_text(std::vector<ivec4> &tets, std::string filename);
     void read_text(std::vector<ivec3> &tris, std::string filename);
 
-    std::vector<vec> read_plot3d_q(std::string filename, int &x, int &y, int &z, int &dim);
-    std::vector<point> read_plot3d_x(std::string filename, int &x, int &y, int &z);
+    // vectors to detect instead of zero, one per line (vx vy [vz])
+    void read_targets(std::vector<point> &targets, const std::string &filename, int vdim);
 
     int read_vti(std::vector<size_t> &dims, std::vector<vec> &vfield, std::vector<point> &points, std::string filename);
 
+    // structured (curvilinear) grid, whose topology is given by dims. returns the dimensionality
+    template <typename T>
+    int read_vts(std::vector<size_t> &dims, std::vector<Vec<3,T> > &vfield, std::vector<point> &points, std::string filename);
+
+    // unstructured grid with tets (3D) or triangles (2D). returns the dimensionality
+    // grids with other cells (quads, pyramids, wedges, hexahedra) are returned in mesh instead
+    int read_vtu(std::vector<point> &points, std::vector<vec> &vfield, std::vector<ivec4> &tets, std::vector<ivec3> &tris,
+                 MixedMesh &mesh, std::string filename);
+
+    // a block of a regular grid, e.g., of a partitioned (.pvti) or multi-block (.vtm) image dataset
+    template <typename T>
+    struct GridBlock {
+        std::string filename;           // the .vti file of the block
+        std::vector<size_t> dims;       // number of vertices of the block
+        std::vector<size_t> offset;     // index of the first vertex in the global grid
+        std::vector<Vec<3,T> > vfield;  // filled by read_vti (or the other grid readers)
+        std::vector<point> points;
+    };
+    typedef GridBlock<double> ImageBlock;
+
+    // list the blocks of a .pvti or .vtm file, without reading their data.
+    // global_dims is set if the blocks tile one regular grid, and left empty otherwise (e.g., AMR levels)
+    template <typename T>
+    void read_blocks_info(std::vector<GridBlock<T> > &blocks, std::vector<size_t> &global_dims, const std::string &filename);
+
+    // -------------------------------------------------------------------
+    // region of interest of a regular grid
+    // -------------------------------------------------------------------
+    // a box in vertex indices or in physical coordinates. the default box covers any grid
+    struct Box {
+        bool physical = false;
+        double lo[3] = {0, 0, 0};
+        double hi[3] = {1e300, 1e300, 1e300};
+    };
+
+    // origin and spacing of a regular grid with uniform spacing.
+    // returns false if the coordinates are not uniform (a curvilinear grid)
+    bool grid_geometry(const std::vector<size_t> &dims, const std::vector<point> &points, double origin[3], double spacing[3]);
+
+    // the smallest range of vertices [lo, hi] that covers the cells intersecting a box.
+    // returns false if the box does not intersect the grid
+    bool covering_region(const Box &box, const std::vector<size_t> &dims, const double origin[3], const double spacing[3],
+                         size_t lo[3], size_t hi[3]);
+
+    // the same, for a physical box in a curvilinear grid: the cells whose bounding box intersects the box
+    bool covering_region(const Box &box, const std::vector<size_t> &dims, const std::vector<point> &points,
+                         size_t lo[3], size_t hi[3]);
+
+    // the part of a grid (already in memory) that covers a box
+    template <typename T>
+    void crop(GridBlock<T> &block, const std::vector<size_t> &dims, const std::vector<Vec<3,T> > &vfield,
+              const std::vector<point> &points, const Box &box);
+
+    // read the part of a .vti file that covers a box. returns the dimensionality
+    template <typename T>
+    int read_vti(GridBlock<T> &block, std::vector<size_t> &global_dims, const Box &box);
+
+    // read the part of a raw file that covers a box. a raw file has no header, and
+    // stores vdim values of type T per vertex in row-major order. the vertex coordinates are their indices
+    template <typename T>
+    void read_raw(GridBlock<T> &block, const std::vector<size_t> &global_dims, int vdim, const Box &box);
+
+    // -------------------------------------------------------------------
+    // scalar field on a regular grid with uniform spacing (e.g., to detect the
+    // critical points of its gradient)
+    // -------------------------------------------------------------------
+    template <typename T>
+    struct ScalarGrid {
+        std::vector<size_t> dims;
+        double origin[3] = {0, 0, 0};
+        double spacing[3] = {1, 1, 1};
+        std::vector<T> values;
+    };
+
+    // a raw file of one value of type T per vertex, in row-major order
+    template <typename T>
+    void read_raw(ScalarGrid<T> &grid, const std::string &filename, const std::vector<size_t> &dims);
+
+    // the active scalars of a .vti file, or its first array with one component
+    template <typename T>
+    void read_vti(ScalarGrid<T> &grid, const std::string &filename);
+
+    // -------------------------------------------------------------------
+    // brick file (.rcpb): a regular grid stored in compressed bricks of cells.
+    // a brick also stores the vertices on its upper faces, so its cells can be
+    // processed without the neighboring bricks. an index at the start of the
+    // file gives the location and the per-component value range of every brick
+    // -------------------------------------------------------------------
+    enum BrickCodec { BRICK_RAW = 0, BRICK_LZ4 = 1 };
+
+    struct BrickInfo {
+        uint64_t offset, csize;         // location of the (compressed) data in the file
+        uint32_t codec;
+        uint32_t first[3];              // index of the first vertex in the grid
+        uint32_t dims[3];               // number of vertices
+        double vmin[3], vmax[3];        // range of every component
+    };
+
+    class BrickFile {
+
+        std::string filename;
+
+    public:
+        uint32_t ncomps;                // 2 or 3
+        uint32_t dtype;                 // bytes per component (4 or 8)
+        uint32_t bsize;                 // cells per brick along each axis
+        std::vector<size_t> dims;       // number of vertices of the grid
+        double origin[3], spacing[3];
+        std::vector<BrickInfo> bricks;
+
+        // read the header and the index
+        void open(const std::string &filename);
+
+        // can a brick contain a value whose components are all within eps of zero?
+        bool may_contain_zero(size_t b, double eps) const;
+
+        // read one brick, generating the coordinates of its vertices. may be called concurrently.
+        // if lo and hi are given, only the vertices of the brick within [lo, hi] are kept
+        template <typename T>
+        void read_brick(size_t b, std::vector<Vec<3,T> > &vfield, std::vector<point> &points,
+                        const size_t *lo = 0, const size_t *hi = 0) const;
+    };
+
+    // write a regular grid (with uniform spacing) as bricks of bsize^dim cells, keeping the scalar type
+    template <typename T>
+    void write_bricks(const std::string &filename, const std::vector<size_t> &dims,
+                      const std::vector<Vec<3,T> > &vfield, const std::vector<point> &points, int vdim, uint32_t bsize);
+
+    // -------------------------------------------------------------------
+    // field stream: a regular grid sent through a pipe or a FIFO by a running
+    // simulation. a header gives the grid, and the vertices follow in chunks of
+    // any size, in row-major order. the stream is read once, without seeking
+    // -------------------------------------------------------------------
+    class FieldStream {
+
+        std::string name;
+        FILE *in;
+        size_t next;                    // index of the next vertex
+        uint64_t remaining;             // vertices left in the current chunk
+        std::vector<char> buffer;
 
+        // read exactly size bytes. returns false at the end of the stream
+        bool read_bytes(void *data, size_t size);
 
-    point get_centroid(const ivec4 &tet, const std::vector<point> &points);
-    point get_centroid(const ivec3 &tri, const std::vector<point> &points);
+    public:
+        uint32_t ncomps;                // 2 or 3
+        uint32_t dtype;                 // bytes per component (4 or 8)
+        std::vector<size_t> dims;       // number of vertices (2 for 2D grids)
+        double origin[3], spacing[3];
+
+        FieldStream() : in(0), next(0), remaining(0) {}
+        ~FieldStream();
+
+        // open a file, a FIFO, or the standard input ("-"), and read the header.
+        // blocks until the writer sends the header
+        void open(const std::string &name);
+
+        // append the next n vertices (fewer at the end of the stream), generating
+        // their coordinates. returns the number of vertices appended
+        template <typename T>
+        size_t read(size_t n, std::vector<Vec<3,T> > &vfield, std::vector<point> &points);
+    };
+
+    // -------------------------------------------------------------------
+    // binary plot3d files: a grid file (.x, .xyz) gives the coordinates, and a
+    // solution (.q) or function file (.f) gives the values of one or more
+    // curvilinear grids. the layout (single or multiple grids, 2D or 3D, fortran
+    // record markers, byte order, precision, and blanking) is detected from the
+    // header and the size of the file
+    // -------------------------------------------------------------------
+    enum Plot3DKind { PLOT3D_GRID, PLOT3D_SOLUTION, PLOT3D_FUNCTION };
+
+    class Plot3DFile {
+
+        std::string filename;
+        bool swap;                      // the byte order differs from the machine
+        std::vector<uint64_t> offsets;  // location of the data read for every grid
+
+    public:
+        Plot3DKind kind;
+        bool records;                   // fortran record markers around every record
+        int dim;                        // 2 or 3
+        uint32_t dtype;                 // bytes per value (4 or 8)
+        bool iblank;                    // the grid file stores blanking flags
+        std::vector<std::vector<size_t> > dims;     // number of vertices of every grid
+        std::vector<size_t> nvars;      // number of variables of every grid (solution and function files)
+
+        // read the header, and detect the layout
+        void open(const std::string &filename, Plot3DKind kind);
+
+        size_t num_grids() const {  return dims.size();   }
+
+        // read the coordinates of grid g with one read. may be called concurrently
+        void read_points(size_t g, std::vector<point> &points) const;
+
+        // read the vector field of grid g with one read: the momentum of a
+        // solution file, or the first dim variables of a function file. may be called concurrently
+        template <typename T>
+        void read_vectors(size_t g, std::vector<Vec<3,T> > &vfield) const;
+    };
+
+    // write critical points of a mixed mesh as: cell_id simplex_id x y z
+    void write_cp(const std::string &filename, const std::vector<size_t> &cp, const MixedMesh &mesh, const std::vector<point> &points);
+
+    // write critical points given by their (global) simplex ids and centroids
+    void write_cp(const std::string &filename, const std::vector<size_t> &ids, const std::vector<point> &centroids);
+
+    // write the simplices with critical points in some members of an ensemble as: simplex_id count x y z
+    void write_cp_counts(const std::string &filename, const std::vector<size_t> &ids, const std::vector<size_t> &counts,
+                         const std::vector<point> &centroids);
+
+    // write tracks of critical points as one line per node: track x y z t. track k has the
+    // nodes offsets[k] ... offsets[k+1]-1, at the given positions and times
+    void write_tracks(const std::string &filename, const std::vector<size_t> &offsets, const std::vector<point> &points,
+                      const std::vector<double> &times);
+
+
+
+    template<int N, typename I>
+    point get_centroid(const Vec<N,I> &simplex, const std::vector<point> &points) {
+
+        point p = points[simplex[0]];
+        for(int i = 1; i < N; i++)
+            p += points[simplex[i]];
+        return p / double(N);
+    }
 
     template<typename T>
-    void write_cp(const std::string &filename, const std::vector<size_t> &cp, const std::vector<T> &cells, const std::vector<point> &points) {
+    point get_centroid(const std::vector<T> &cells, size_t t, const std::vector<point> &points) {
+        return get_centroid(cells[t], points);
+    }
+
+    template<typename Stencil>
+    point get_centroid(const StructuredGrid<Stencil> &grid, size_t t, const std::vector<point> &points) {
+        return grid.centroid(t, points);
+    }
+
+    // cells is a vector of simplices or a StructuredGrid
+    template<typename Cells>
+    void write_cp(const std::string &filename, const std::vector<size_t> &cp, const Cells &cells, const std::vector<point> &points) {
 
         std::ofstream infile(filename.c_str());
         if(!infile.is_open()){
@@ -54,7 +297,7 @@ namespace RW{
         for(size_t i = 0; i < cp.size(); i++){
 
             size_t t = cp[i];
-            point p = get_centroid(cells[t], points);
+            point p = get_centroid(cells, t, points);
 
             infile << t << " " << p[0] << " " << p[1] << " " << p[2] << std::endl;
         }
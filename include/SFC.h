@@ -0,0 +1,97 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+#ifndef _SFC_H_
+#define _SFC_H_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "vec.h"
+#include "parallel.h"
+
+// -----------------------------------------------------------------------
+// Space-filling curve reordering of unstructured meshes, so that consecutive
+// simplices touch nearby vertices.
+//
+// Reordering the cells does not change the result, and the permutation is
+// kept to report the original simplex ids. Reordering the vertices changes
+// their SoS indices, i.e., the order of the symbolic perturbation. The result
+// is still robust, but may differ in degenerate configurations.
+// -----------------------------------------------------------------------
+namespace SFC {
+
+    enum Curve { NONE, MORTON, HILBERT };
+
+    Curve parse_curve(const std::string &name);
+
+    // curve index of every point (21 bits per axis within the bounding box)
+    std::vector<uint64_t> codes(const std::vector<point> &points, Curve curve);
+
+    // permutation that sorts the codes, i.e., perm[new] = old
+    std::vector<size_t> sort_permutation(const std::vector<uint64_t> &codes);
+
+    // reorder the cells along the curve through their centroids. returns perm[new] = old
+    template <int N, typename I>
+    std::vector<size_t> reorder_cells(std::vector<Vec<N,I> > &cells, const std::vector<point> &points, Curve curve) {
+
+        const size_t ncells = cells.size();
+
+        std::vector<point> centroids (ncells);
+        #pragma omp parallel for
+        for(size_t t = 0; t < ncells; t++){
+            point p = points[cells[t][0]];
+            for(int i = 1; i < N; i++)
+                p += points[cells[t][i]];
+            centroids[t] = p / double(N);
+        }
+
+        std::vector<size_t> perm = sort_permutation(codes(centroids, curve));
+
+        std::vector<Vec<N,I> > sorted (ncells);
+        #pragma omp parallel for
+        for(size_t t = 0; t < ncells; t++)
+            sorted[t] = cells[perm[t]];
+        cells.swap(sorted);
+        return perm;
+    }
+
+    // reorder the vertices along the curve, and renumber the cells accordingly
+    template <int N, typename I>
+    void reorder_vertices(std::vector<point> &points, std::vector<vec> &vfield, std::vector<Vec<N,I> > &cells, Curve curve) {
+
+        const size_t nverts = points.size();
+        std::vector<size_t> perm = sort_permutation(codes(points, curve));
+
+        std::vector<I> inv (nverts);
+        std::vector<point> spoints (nverts);
+        std::vector<vec> svfield (nverts);
+
+        #pragma omp parallel for
+        for(size_t v = 0; v < nverts; v++){
+            inv[perm[v]] = I(v);
+            spoints[v] = points[perm[v]];
+            svfield[v] = vfield[perm[v]];
+        }
+
+        #pragma omp parallel for
+        for(size_t t = 0; t < cells.size(); t++){
+            for(int i = 0; i < N; i++)
+                cells[t][i] = inv[cells[t][i]];
+        }
+
+        points.swap(spoints);
+        vfield.swap(svfield);
+    }
+}
+#endif
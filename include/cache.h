@@ -0,0 +1,76 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// -----------------------------------------------------------------------
+// 128-bit hashes (as 32 hex digits) for addressing content. not cryptographic.
+// -----------------------------------------------------------------------
+namespace Hash {
+
+    std::string string(const std::string &data);
+
+    // a file is read in a stream of fixed-size blocks, which are hashed in
+    // parallel. the hash does not depend on the number of threads
+    std::string file(const std::string &filename);
+}
+
+// -----------------------------------------------------------------------
+// An on-disk cache of critical points, addressed by the content of the input
+// files and the arguments of a run.
+//
+// The directory holds one output file per key, and an index of the content
+// hash of every input file seen, together with its size and modification
+// time. As long as these match, a file is not read again, and a repeated run
+// only copies the cached output.
+// -----------------------------------------------------------------------
+class ResultCache {
+
+    struct Entry {
+        uint64_t size;
+        int64_t mtime;              // in nanoseconds
+        std::string hash;
+    };
+
+    std::string dir;
+    std::map<std::string, Entry> index;     // by absolute path
+
+    std::string index_file() const {                        return dir + "/index.txt";  }
+    std::string result_file(const std::string &key) const { return dir + "/" + key + ".cp.txt";    }
+
+public:
+    // the result format (and hence the keys) changes with this version
+    static const int VERSION = 1;
+
+    ResultCache(const std::string &dir);
+
+    // the content hash of a file, which is read only if its size or modification time changed
+    std::string file_hash(const std::string &filename);
+
+    // the key of a run, given its arguments, where the input files are replaced by their hashes
+    static std::string key(const std::vector<std::string> &parts);
+
+    // copy the cached output of a run. returns false if there is none
+    bool fetch(const std::string &key, const std::string &outfilename) const;
+
+    // store the output of a run
+    void store(const std::string &key, const std::string &outfilename) const;
+};
+#endif
@@ -0,0 +1,152 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+#ifndef _CELLS_H_
+#define _CELLS_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "vec.h"
+
+// -----------------------------------------------------------------------
+// Meshes of mixed cell types, which are split into simplices on the fly.
+//
+// A cell is split by connecting its smallest vertex (by global id) to every
+// face that does not contain it, where the quad faces are split along the
+// diagonal through their smallest vertex. Since the split of a face depends
+// only on its own vertex ids, the neighboring cells agree on the shared faces.
+// The cells are convex, so the resulting simplices do not overlap.
+//
+// The cell types and their vertex orderings follow VTK.
+// -----------------------------------------------------------------------
+
+enum CellType {
+    CELL_TRIANGLE = 5,
+    CELL_QUAD = 9,
+    CELL_TETRA = 10,
+    CELL_HEXAHEDRON = 12,
+    CELL_WEDGE = 13,
+    CELL_PYRAMID = 14
+};
+
+struct MixedMesh {
+
+    std::vector<uint8_t> types;     // type of every cell
+    std::vector<size_t> offsets;    // cell c has vertices conn[offsets[c]] ... conn[offsets[c+1]-1]
+    std::vector<int> conn;
+
+    MixedMesh() : offsets(1, 0) {}
+
+    size_t num_cells() const {  return types.size(); }
+
+    void add_cell(uint8_t type, const int *v, int n) {
+        types.push_back(type);
+        conn.insert(conn.end(), v, v+n);
+        offsets.push_back(conn.size());
+    }
+
+    const int* cell(size_t c) const {   return &conn[offsets[c]];  }
+};
+
+namespace Cells {
+
+    // maximum number of simplices per cell (hexahedron)
+    static const int MAX_SIMPLICES = 6;
+
+    inline int dim(uint8_t type) {
+        return (type == CELL_TRIANGLE || type == CELL_QUAD) ? 2 : 3;
+    }
+
+    // split a quad (a,b,c,d), given in cyclic order, along the diagonal through its smallest vertex
+    inline int split_quad(const int *q, Vec<3,int> *tris) {
+
+        int m = 0;
+        for(int i = 1; i < 4; i++)
+            if(q[i] < q[m])     m = i;
+
+        tris[0] = Vec<3,int>(q[m], q[(m+1)%4], q[(m+2)%4]);
+        tris[1] = Vec<3,int>(q[m], q[(m+2)%4], q[(m+3)%4]);
+        return 2;
+    }
+
+    // split a 2D cell into triangles. returns the number of triangles
+    inline int split(uint8_t type, const int *v, Vec<3,int> *tris) {
+
+        if(type == CELL_TRIANGLE){
+            tris[0] = Vec<3,int>(v[0], v[1], v[2]);
+            return 1;
+        }
+        if(type == CELL_QUAD)
+            return split_quad(v, tris);
+        return 0;
+    }
+
+    // split a 3D cell into tets. returns the number of tets
+    inline int split(uint8_t type, const int *v, Vec<4,int> *tets) {
+
+        // faces of every cell type, as local vertex indices (-1 for triangles)
+        static const int tet_faces[4][4] = { {0,1,2,-1}, {0,1,3,-1}, {1,2,3,-1}, {0,2,3,-1} };
+        static const int pyr_faces[5][4] = { {0,1,2,3}, {0,1,4,-1}, {1,2,4,-1}, {2,3,4,-1}, {3,0,4,-1} };
+        static const int wdg_faces[5][4] = { {0,1,2,-1}, {3,4,5,-1}, {0,1,4,3}, {1,2,5,4}, {2,0,3,5} };
+        static const int hex_faces[6][4] = { {0,1,2,3}, {4,5,6,7}, {0,1,5,4}, {1,2,6,5}, {2,3,7,6}, {3,0,4,7} };
+
+        const int (*faces)[4] = 0;
+        int nverts = 0, nfaces = 0;
+        switch(type){
+            case CELL_TETRA:        faces = tet_faces;  nverts = 4;     nfaces = 4;     break;
+            case CELL_PYRAMID:      faces = pyr_faces;  nverts = 5;     nfaces = 5;     break;
+            case CELL_WEDGE:        faces = wdg_faces;  nverts = 6;     nfaces = 5;     break;
+            case CELL_HEXAHEDRON:   faces = hex_faces;  nverts = 8;     nfaces = 6;     break;
+            default:                return 0;
+        }
+
+        if(type == CELL_TETRA){
+            tets[0] = Vec<4,int>(v[0], v[1], v[2], v[3]);
+            return 1;
+        }
+
+        int m = 0;
+        for(int i = 1; i < nverts; i++)
+            if(v[i] < v[m])     m = i;
+
+        int ntets = 0;
+        for(int f = 0; f < nfaces; f++){
+
+            const int *face = faces[f];
+            const int fsize = (face[3] < 0) ? 3 : 4;
+
+            bool has_m = false;
+            for(int i = 0; i < fsize; i++)
+                has_m = has_m || (face[i] == m);
+            if(has_m)
+                continue;
+
+            Vec<3,int> tris[2];
+            int ntris;
+            if(fsize == 3){
+                tris[0] = Vec<3,int>(v[face[0]], v[face[1]], v[face[2]]);
+                ntris = 1;
+            }
+            else {
+                const int q[4] = { v[face[0]], v[face[1]], v[face[2]], v[face[3]] };
+                ntris = split_quad(q, tris);
+            }
+
+            for(int t = 0; t < ntris; t++)
+                tets[ntets++] = Vec<4,int>(v[m], tris[t][0], tris[t][1], tris[t][2]);
+        }
+        return ntets;
+    }
+}
+#endif
@@ -0,0 +1,140 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+
+#ifndef _ENSEMBLE_H_
+#define _ENSEMBLE_H_
+
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include "vec.h"
+#include "CP.h"
+#include "stencil.h"
+
+// -----------------------------------------------------------------------
+// Critical points of the members of an ensemble (vector fields on the same
+// regular grid), in one traversal of the simplices.
+//
+// The values of the members are interleaved: member m at vertex v is at
+// v*nmembers + m. Hence, the filter reads the values of all the members at a
+// vertex together, and loops over the members without branches. Only the
+// members that pass the filter are tested exactly, and only their vertices
+// are loaded into SoS.
+//
+// One SoS matrix holds all the members, with row v*nmembers + m + 1. The rows
+// of a member are in the order of its vertices, and the simplices of a member
+// use only its own rows (and zero). Hence, the result of every member is the
+// same as when it is detected on its own.
+// -----------------------------------------------------------------------
+namespace Ensemble {
+
+    // number of members that fit in one SoS matrix
+    template <typename T>
+    size_t max_members(size_t nverts) {
+        return CPDetector<T>::MAX_VERTICES / nverts;
+    }
+
+    // cps[m] gets the ids of the simplices with critical points in member m
+    template <typename Stencil, typename T>
+    void detect(const StructuredGrid<Stencil> &grid, const std::vector<Vec<3,T> > &values, size_t nmembers,
+                std::vector<std::vector<size_t> > &cps, bool quiet = false) {
+
+        const size_t N = nmembers;
+        const double eps = CPDetector<T>::SOS_EPS;
+
+        CPDetector<T> *CPD = new CPDetector<T>(&values, Stencil::dim);
+        CPD->set_quiet(quiet);
+
+        if(!quiet){
+            printf(" Detecting %dD Critical Points in %ld members..", Stencil::dim, N);
+            fflush(stdout);
+        }
+
+        cps.assign(N, std::vector<size_t>());
+
+        // per member: the values of all vertices are positive (or negative) in the
+        // current component, and the simplex cannot contain zero
+        std::vector<uint8_t> pos (N), neg (N), skip (N);
+
+        // the simplices of the members that pass the filter (as s*N + m), and their SoS rows
+        std::vector<size_t> candidates;
+        std::vector<uint8_t> used (values.size(), 0);
+
+        grid.for_each_cell([&](size_t c, const size_t *v, int p) {
+
+            const int (&S)[Stencil::nsimplices][Stencil::dim+1] = Stencil::simplices[p];
+
+            for(int k = 0; k < Stencil::nsimplices; k++){
+
+                const Vec<3,T> *rows[Stencil::dim+1];
+                for(int i = 0; i <= Stencil::dim; i++)
+                    rows[i] = &values[v[S[k][i]]*N];
+
+                std::fill(skip.begin(), skip.end(), 0);
+                for(int d = 0; d < Stencil::dim; d++){
+
+                    std::fill(pos.begin(), pos.end(), 1);
+                    std::fill(neg.begin(), neg.end(), 1);
+                    for(int i = 0; i <= Stencil::dim; i++){
+                        const Vec<3,T> *row = rows[i];
+                        for(size_t m = 0; m < N; m++){
+                            const double val = row[m][d];
+                            pos[m] &= (val >= eps);
+                            neg[m] &= (val <= -eps);
+                        }
+                    }
+                    for(size_t m = 0; m < N; m++)
+                        skip[m] |= pos[m] | neg[m];
+                }
+
+                for(size_t m = 0; m < N; m++){
+
+                    if(skip[m])
+                        continue;
+
+                    candidates.push_back((c*Stencil::nsimplices + k)*N + m);
+                    for(int i = 0; i <= Stencil::dim; i++)
+                        used[v[S[k][i]]*N + m] = 1;
+                }
+            }
+        });
+
+        CPD->load(&used);
+        std::vector<uint8_t>().swap(used);
+
+        for(size_t i = 0; i < candidates.size(); i++){
+
+            const size_t id = candidates[i] / N, m = candidates[i] % N;
+            const typename StructuredGrid<Stencil>::simplex_t simplex = grid[id];
+
+            size_t s[Stencil::dim+1];
+            for(int j = 0; j <= Stencil::dim; j++)
+                s[j] = simplex[j]*N + m;
+
+            if(CPD->contains_zero(s))
+                cps[m].push_back(id);
+        }
+
+        size_t ncps = 0;
+        for(size_t m = 0; m < N; m++)
+            ncps += cps[m].size();
+        if(!quiet)
+            printf(" Detected %ld simplices with critical points! (%ld exact tests)\n", ncps, candidates.size());
+
+        delete CPD;
+    }
+}
+#endif
@@ -0,0 +1,96 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+
+#ifndef _GRADIENT_H_
+#define _GRADIENT_H_
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include "vec.h"
+
+// -----------------------------------------------------------------------
+// Gradient of a scalar field on a regular grid, by finite differences.
+//
+// The gradient is computed for a range of vertex layers along the last axis
+// of the grid at a time, so the vector field of the whole grid is never
+// stored. Along a periodic axis the differences wrap around; otherwise they
+// become one-sided at the boundary.
+// -----------------------------------------------------------------------
+namespace Gradient {
+
+    enum Scheme {
+        CENTRAL,    // second order:  (f[i+1] - f[i-1]) / 2h
+        FOURTH      // fourth order:  (f[i-2] - 8f[i-1] + 8f[i+1] - f[i+2]) / 12h
+    };
+
+    inline bool parse_scheme(const std::string &name, Scheme &scheme) {
+        if (name.empty() || name == "central")  {   scheme = CENTRAL;   return true;    }
+        if (name == "fourth")                   {   scheme = FOURTH;    return true;    }
+        return false;
+    }
+
+    // derivative at index i of a line of n values, stride apart
+    template <typename T>
+    double derivative(const T *line, size_t stride, size_t i, size_t n, bool periodic, double h, Scheme scheme) {
+
+        if (n < 2)
+            return 0;
+
+        const long m = long(n), k = long(i);
+        auto f = [line, stride, m, periodic](long j) {
+            if (periodic)   j = ((j % m) + m) % m;
+            return double(line[size_t(j)*stride]);
+        };
+
+        if (scheme == FOURTH && m >= 5 && (periodic || (k >= 2 && k+2 < m)))
+            return (f(k-2) - 8*f(k-1) + 8*f(k+1) - f(k+2)) / (12*h);
+        if (periodic || (k >= 1 && k+1 < m))
+            return (f(k+1) - f(k-1)) / (2*h);
+        if (k == 0)
+            return (f(1) - f(0)) / h;
+        return (f(m-1) - f(m-2)) / h;
+    }
+
+    // gradient at the vertices of the layers [first, last] along the last axis
+    template <typename T>
+    void compute(const std::vector<T> &values, const std::vector<size_t> &dims, const double spacing[3],
+                 const std::vector<bool> &periodic, Scheme scheme, size_t first, size_t last,
+                 std::vector<Vec<3,T> > &grad) {
+
+        const size_t X = dims[0], Y = dims[1], Z = (dims.size() > 2) ? dims[2] : 1;
+        const size_t n[3] = {X, Y, Z};
+        const size_t stride[3] = {1, X, X*Y};
+        const int dim = (dims.size() > 2 && Z > 1) ? 3 : 2;
+        const int axis = dim-1;
+
+        const size_t vfirst = first*stride[axis];
+        const size_t count = (last - first + 1)*stride[axis];
+        grad.assign(count, Vec<3,T>());
+
+        #pragma omp parallel for
+        for (long long l = 0; l < (long long)count; l++) {
+
+            const size_t v = vfirst + size_t(l);
+            const size_t ijk[3] = {v % X, (v / X) % Y, v / (X*Y)};
+
+            for (int a = 0; a < dim; a++) {
+                const bool p = (a < int(periodic.size())) && periodic[a];
+                const T *line = &values[v - ijk[a]*stride[a]];
+                grad[size_t(l)][a] = T(derivative(line, stride[a], ijk[a], n[a], p, spacing[a], scheme));
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,81 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+
+#ifndef _NUMA_H_
+#define _NUMA_H_
+
+#include <vector>
+#include <cstddef>
+
+// -----------------------------------------------------------------------
+// Placement of the large arrays on the memory of NUMA nodes.
+//
+// The parallel loops over the grid, the simplices, and the pages of an array
+// all split their range statically: thread t of n works on the t-th of n
+// contiguous parts (Parallel::part). Once the threads are pinned to the nodes
+// in blocks of consecutive threads, an array whose pages are first touched by
+// the same split is placed on the node of the threads that later read it.
+//
+// Without init, or on a single node, the allocation is as usual.
+// -----------------------------------------------------------------------
+namespace Numa {
+
+    // pin the OpenMP threads to the nodes (with numa), and back the large
+    // arrays by transparent huge pages (with huge_pages)
+    void init(bool numa, bool huge_pages);
+
+    // are the threads pinned?
+    bool active();
+
+    // ask for huge pages for the whole 2 MiB pages of [p, p+bytes)
+    void advise(void *p, size_t bytes);
+
+    // touch the pages of [p, p+bytes) from the threads that work on them
+    void touch(void *p, size_t bytes);
+
+    // sample the pages of [p, p+bytes) and print how many are on the node of
+    // the thread that works on them
+    void report(const char *name, const void *p, size_t bytes);
+
+    // room for n elements, which is placed but not yet constructed
+    template <typename T>
+    void allocate(std::vector<T> &v, size_t n) {
+        std::vector<T>().swap(v);
+        v.reserve(n);
+        advise(v.data(), n*sizeof(T));
+        touch(v.data(), n*sizeof(T));
+    }
+
+    // resize an empty array to n elements, placed by the threads that work on them
+    template <typename T>
+    void first_touch(std::vector<T> &v, size_t n) {
+        allocate(v, n);
+        v.resize(n);
+    }
+
+    // move an array filled by a single thread onto the nodes that work on it
+    template <typename T>
+    void place(std::vector<T> &v, const char *name) {
+
+        if (!active() || v.empty())
+            return;
+
+        std::vector<T> placed;
+        allocate(placed, v.size());
+        placed.insert(placed.end(), v.begin(), v.end());
+        v.swap(placed);
+        report(name, v.data(), v.size()*sizeof(T));
+    }
+}
+#endif
@@ -0,0 +1,184 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+
+#ifndef _OPTIONS_H_
+#define _OPTIONS_H_
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+#include "RW.h"
+#include "SFC.h"
+#include "gradient.h"
+
+// -----------------------------------------------------------------------
+// options of the form --name=value, shared by the command line and the server
+// -----------------------------------------------------------------------
+struct Options {
+
+    int stencil = 5;            // tets per cube for 3D regular grids (5 or 6)
+    std::vector<bool> periodic = std::vector<bool>(3, false);  // periodic axes of regular grids
+    SFC::Curve reorder = SFC::NONE;     // reorder the cells of unstructured meshes along a curve
+    bool reorder_vertices = false;      // ... and their vertices
+    size_t pipeline = 0;                // cell layers per chunk for the staged driver (0 = off)
+    bool stream = false;                // the input is a field stream (a FIFO, or - for stdin), detected to stdout
+    std::string bricks;                 // convert a regular grid to this brick file, instead of detecting
+    uint32_t brick_size = 32;           // cells per brick along each axis
+    bool float32 = false;               // read the vector field of regular grids in single precision
+    bool gradient = false;              // detect in the gradient of a scalar field
+    Gradient::Scheme gradient_scheme = Gradient::CENTRAL;
+    bool ensemble = false;              // the input is a list of the members of an ensemble
+    bool track = false;                 // the input is a list of timesteps, whose critical points are tracked
+    std::string targets;                // file of the vectors to detect instead of zero
+    std::vector<size_t> tile;           // cells per tile of regular grids (empty = sized to the cache, 0 = off)
+    bool roi = false;                   // detect only in the region of a regular grid that covers box
+    RW::Box box;
+    std::string serve;                  // serve requests on this Unix domain socket
+    size_t cache = 4;                   // number of datasets kept in memory by the server
+    std::string result_cache;           // directory of the on-disk cache of results
+    size_t validate = 0;                // validate the fast paths in this many trials, instead of detecting
+    bool numa = false;                  // pin the threads to the NUMA nodes, and place the arrays on them
+    bool huge_pages = false;            // back the large arrays by transparent huge pages
+    std::vector<std::string> given;     // the options given that can change the result
+};
+
+// parse a box given as lo:hi,lo:hi[,lo:hi]
+inline bool parse_box(const std::string &value, bool physical, RW::Box &box) {
+
+    box.physical = physical;
+
+    std::istringstream iss(value);
+    std::string range;
+    int a = 0;
+    for(; a < 3 && std::getline(iss, range, ','); a++){
+
+        const size_t colon = range.find(':');
+        if (colon == std::string::npos)
+            return false;
+        box.lo[a] = atof(range.substr(0, colon).c_str());
+        box.hi[a] = atof(range.substr(colon+1).c_str());
+    }
+    return (a >= 2) && iss.eof();
+}
+
+// parse one option (--name or --name=value). returns an error message, or an empty string
+inline std::string parse_option(const std::string &arg, Options &opts) {
+
+    const size_t eq = arg.find('=');
+    const std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq-2);
+    const std::string value = (eq == std::string::npos) ? std::string() : arg.substr(eq+1);
+
+    if (name == "stencil") {
+        opts.stencil = atoi(value.c_str());
+        if (opts.stencil != 5 && opts.stencil != 6)
+            return " Invalid stencil " + value + ". Can be 5 or 6 tets per cube!";
+    }
+    else if (name == "periodic") {
+        for(size_t i = 0; i < value.size(); i++){
+            if (value[i] < 'x' || value[i] > 'z')
+                return " Invalid periodic axes " + value + ". Can be any of x, y, and z!";
+            opts.periodic[value[i]-'x'] = true;
+        }
+    }
+    else if (name == "reorder") {
+        opts.reorder = SFC::parse_curve(value);
+    }
+    else if (name == "reorder-vertices") {
+        opts.reorder_vertices = true;
+    }
+    else if (name == "pipeline") {
+        opts.pipeline = value.empty() ? 16 : size_t(atol(value.c_str()));
+        if (opts.pipeline == 0)
+            return " Invalid number of layers per chunk " + value;
+    }
+    else if (name == "stream") {
+        opts.stream = true;
+    }
+    else if (name == "write-bricks") {
+        opts.bricks = value;
+        if (opts.bricks.empty())
+            return " Missing name of the brick file";
+    }
+    else if (name == "brick") {
+        opts.brick_size = uint32_t(atol(value.c_str()));
+        if (opts.brick_size == 0)
+            return " Invalid brick size " + value;
+    }
+    else if (name == "float32") {
+        opts.float32 = true;
+    }
+    else if (name == "gradient") {
+        if (!Gradient::parse_scheme(value, opts.gradient_scheme))
+            return " Invalid gradient scheme " + value + ". Can be central or fourth!";
+        opts.gradient = true;
+    }
+    else if (name == "ensemble") {
+        opts.ensemble = true;
+    }
+    else if (name == "track") {
+        opts.track = true;
+    }
+    else if (name == "targets") {
+        opts.targets = value;
+        if (opts.targets.empty())
+            return " Missing name of the file of targets";
+    }
+    else if (name == "tile") {
+        std::istringstream iss(value);
+        std::string size;
+        opts.tile.clear();
+        while (std::getline(iss, size, ','))
+            opts.tile.push_back(size_t(atol(size.c_str())));
+        if (opts.tile.empty() || opts.tile.size() > 3)
+            return " Invalid tile size " + value + ". Expected N or X,Y[,Z]";
+    }
+    else if (name == "roi" || name == "box") {
+        if (!parse_box(value, name == "box", opts.box))
+            return " Invalid region " + value + ". Expected lo:hi,lo:hi[,lo:hi]";
+        opts.roi = true;
+    }
+    else if (name == "serve") {
+        opts.serve = value;
+        if (opts.serve.empty())
+            return " Missing path of the socket";
+    }
+    else if (name == "result-cache") {
+        opts.result_cache = value;
+        if (opts.result_cache.empty())
+            return " Missing cache directory";
+    }
+    else if (name == "validate") {
+        opts.validate = value.empty() ? 200 : size_t(atol(value.c_str()));
+        if (opts.validate == 0)
+            return " Invalid number of validation trials " + value;
+    }
+    else if (name == "numa") {
+        opts.numa = true;
+    }
+    else if (name == "huge-pages") {
+        opts.huge_pages = true;
+    }
+    else if (name == "cache") {
+        opts.cache = size_t(atol(value.c_str()));
+        if (opts.cache == 0)
+            return " Invalid number of cached datasets " + value;
+    }
+    else {
+        return " Unknown option " + arg;
+    }
+    return std::string();
+}
+#endif
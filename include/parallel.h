@@ -0,0 +1,72 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#include <parallel/algorithm>
+#endif
+
+// -----------------------------------------------------------------------
+// thin wrappers that use OpenMP when available, and are serial otherwise.
+// NOTE: the SoS library keeps global state, so exact predicates must only
+// ever be evaluated from a single thread.
+// -----------------------------------------------------------------------
+namespace Parallel {
+
+    inline int num_threads() {
+#ifdef _OPENMP
+        return omp_get_max_threads();
+#else
+        return 1;
+#endif
+    }
+
+    inline int thread_num() {
+#ifdef _OPENMP
+        return omp_get_thread_num();
+#else
+        return 0;
+#endif
+    }
+
+    // the contiguous part [lo, hi) of n items that thread t of nthreads works on.
+    // the parts of the grid filter and the pages first touched by numa follow it
+    inline void part(size_t n, int t, int nthreads, size_t &lo, size_t &hi) {
+        lo = n * size_t(t) / size_t(nthreads);
+        hi = n * size_t(t+1) / size_t(nthreads);
+    }
+
+    template <typename It, typename Cmp>
+    void sort(It first, It last, Cmp cmp) {
+#if defined(_OPENMP) && defined(__GLIBCXX__)
+        __gnu_parallel::sort(first, last, cmp);
+#else
+        std::sort(first, last, cmp);
+#endif
+    }
+
+    template <typename It>
+    void sort(It first, It last) {
+#if defined(_OPENMP) && defined(__GLIBCXX__)
+        __gnu_parallel::sort(first, last);
+#else
+        std::sort(first, last);
+#endif
+    }
+}
+#endif
@@ -0,0 +1,249 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+
+#include "vec.h"
+#include "CP.h"
+#include "queue.h"
+#include "stencil.h"
+
+// -----------------------------------------------------------------------
+// Staged detection on a regular grid.
+//
+// The grid is cut into chunks of layers of cells along its last axis, which
+// stream through four stages connected by bounded queues:
+//      read -> filter (several threads) -> exact (one thread) -> write
+// so that I/O, the cheap filter, and the exact arithmetic overlap.
+//
+// Every chunk gets its own SoS matrix. The SoS indices within a chunk are in
+// the same order as the global vertex ids, so the vertices shared between
+// chunks are perturbed consistently, and the result equals a single pass.
+// The exact stage runs on one thread, since the SoS library is not thread-safe.
+// T is the scalar type of the vector field.
+// -----------------------------------------------------------------------
+namespace Pipeline {
+
+    template <typename T>
+    struct Chunk {
+
+        size_t index = 0;               // position of the chunk in the stream
+        size_t first = 0;               // first vertex layer in the global grid
+        std::vector<size_t> dims;       // number of vertices of the chunk
+
+        std::vector<Vec<3,T> > vfield;
+        std::vector<point> points;
+
+        std::vector<uint32_t> candidates;   // local simplex ids that passed the filter
+        std::vector<size_t> ids;        // global simplex ids containing cps
+        std::vector<point> centroids;
+    };
+    template <typename T>
+    using ChunkPtr = std::unique_ptr<Chunk<T> >;
+
+    // appends the next n vertices to vfield and points. returns the number read
+    template <typename T>
+    using Source = std::function<size_t(size_t n, std::vector<Vec<3,T> > &vfield, std::vector<point> &points)>;
+
+    // receives the chunks in order, after their cps are detected
+    template <typename T>
+    using Sink = std::function<void(const Chunk<T> &chunk)>;
+
+    // local grid of a chunk, placed in the global grid
+    template <typename Stencil, typename T>
+    StructuredGrid<Stencil> chunk_grid(const Chunk<T> &chunk, const std::vector<size_t> &dims, const std::vector<bool> &periodic) {
+
+        const int axis = Stencil::dim-1;
+
+        std::vector<bool> lperiodic (periodic);
+        if (int(lperiodic.size()) > axis)
+            lperiodic[axis] = false;
+
+        std::vector<size_t> offset (3, 0);
+        offset[axis] = chunk.first;
+
+        StructuredGrid<Stencil> grid (chunk.dims, lperiodic);
+        grid.set_global_extent(offset, dims);
+        return grid;
+    }
+
+    // detect cps in a regular grid of the given dims. layers is the number of
+    // cell layers per chunk. returns the number of cps
+    template <typename Stencil, typename T>
+    size_t run(Source<T> read, Sink<T> write, const std::vector<size_t> &dims, const std::vector<bool> &periodic,
+               size_t layers, int nfilters) {
+
+        const int axis = Stencil::dim-1;
+        const size_t nlayers = dims[axis];
+        const size_t layer_size = (Stencil::dim == 3) ? dims[0]*dims[1] : dims[0];
+
+        if (int(periodic.size()) > axis && periodic[axis]) {
+            std::cerr << " Pipeline::run -- the chunked axis cannot be periodic!\n";
+            exit(1);
+        }
+
+        // a chunk must fit in one SoS matrix, and its local simplex ids in 32 bits.
+        // a layer has at most layer_size cells
+        const size_t max_vertex_layers = CPDetector<T>::MAX_VERTICES / layer_size;
+        const size_t max_cell_layers = size_t(UINT32_MAX) / (layer_size*Stencil::nsimplices);
+        if (max_vertex_layers < 2 || max_cell_layers < 1) {
+            std::cerr << " Pipeline::run -- a layer of " << layer_size << " vertices is too large for one chunk!\n";
+            exit(1);
+        }
+
+        layers = std::min(std::max(size_t(1), layers), std::min(max_vertex_layers-1, max_cell_layers));
+        nfilters = std::max(1, nfilters);
+
+        BoundedQueue<ChunkPtr<T> > to_filter (2*nfilters), to_exact (2*nfilters), to_write (2*nfilters);
+
+        printf(" Pipeline: %ld vertex layers in chunks of %ld cell layers, %d filter threads\n", nlayers, layers, nfilters);
+
+        // ---------------------------------------------------------------
+        // read: consecutive chunks share one layer of vertices
+        std::thread reader([&]() {
+
+            std::vector<Vec<3,T> > last_vfield;
+            std::vector<point> last_points;
+
+            for (size_t index = 0, first = 0; first+1 < nlayers; index++, first += layers) {
+
+                const size_t last = std::min(first + layers, nlayers-1);
+
+                ChunkPtr<T> chunk (new Chunk<T>);
+                chunk->index = index;
+                chunk->first = first;
+                chunk->dims = dims;
+                chunk->dims[axis] = last - first + 1;
+
+                const size_t nnew = (index == 0) ? (last - first + 1) : (last - first);
+
+                chunk->vfield.reserve((last - first + 1) * layer_size);
+                chunk->points.reserve((last - first + 1) * layer_size);
+                chunk->vfield.insert(chunk->vfield.end(), last_vfield.begin(), last_vfield.end());
+                chunk->points.insert(chunk->points.end(), last_points.begin(), last_points.end());
+
+                if (read(nnew * layer_size, chunk->vfield, chunk->points) != nnew * layer_size) {
+                    std::cerr << " Pipeline::run -- unexpected end of input at layer " << first << std::endl;
+                    exit(1);
+                }
+
+                last_vfield.assign(chunk->vfield.end() - layer_size, chunk->vfield.end());
+                last_points.assign(chunk->points.end() - layer_size, chunk->points.end());
+
+                if (!to_filter.push(std::move(chunk)))
+                    break;
+            }
+            to_filter.close();
+        });
+
+        // ---------------------------------------------------------------
+        // filter: candidate simplices, in parallel over chunks
+        std::vector<std::thread> filters;
+        for (int f = 0; f < nfilters; f++) {
+            filters.push_back(std::thread([&]() {
+
+                ChunkPtr<T> chunk;
+                while (to_filter.pop(chunk)) {
+
+                    const StructuredGrid<Stencil> grid = chunk_grid<Stencil>(*chunk, dims, periodic);
+                    const std::vector<Vec<3,T> > &vfield = chunk->vfield;
+                    std::vector<uint32_t> &candidates = chunk->candidates;
+
+                    grid.for_each_cell([&](size_t c, const size_t *v, int p) {
+
+                        for (int k = 0; k < Stencil::nsimplices; k++) {
+
+                            size_t s[Stencil::dim+1];
+                            for (int i = 0; i <= Stencil::dim; i++)
+                                s[i] = v[Stencil::simplices[p][k][i]];
+
+                            if (CPDetector<T>::may_contain_zero(vfield, s, Stencil::dim+1, Stencil::dim))
+                                candidates.push_back(uint32_t(c*Stencil::nsimplices + k));
+                        }
+                    });
+                    to_exact.push(std::move(chunk));
+                }
+            }));
+        }
+
+        // ---------------------------------------------------------------
+        // exact: one SoS matrix per chunk, on this thread only
+        std::thread exact([&]() {
+
+            ChunkPtr<T> chunk;
+            while (to_exact.pop(chunk)) {
+
+                if (!chunk->candidates.empty()) {
+
+                    const StructuredGrid<Stencil> grid = chunk_grid<Stencil>(*chunk, dims, periodic);
+
+                    CPDetector<T> *CPD = new CPDetector<T>(&chunk->vfield, Stencil::dim);
+                    CPD->compute(grid, chunk->candidates);
+
+                    const std::vector<size_t> &cp = CPD->get_CP();
+                    for (size_t i = 0; i < cp.size(); i++) {
+                        chunk->ids.push_back(grid.global_id(cp[i]));
+                        chunk->centroids.push_back(grid.centroid(cp[i], chunk->points));
+                    }
+                    delete CPD;
+                }
+
+                std::vector<Vec<3,T> >().swap(chunk->vfield);
+                std::vector<point>().swap(chunk->points);
+                std::vector<uint32_t>().swap(chunk->candidates);
+                to_write.push(std::move(chunk));
+            }
+        });
+
+        // ---------------------------------------------------------------
+        // write: in the order of the chunks (on the calling thread)
+        size_t ncps = 0;
+        size_t next = 0;
+        std::map<size_t, ChunkPtr<T> > pending;
+
+        std::thread closer([&]() {
+            for (size_t f = 0; f < filters.size(); f++)
+                filters[f].join();
+            to_exact.close();
+            exact.join();
+            to_write.close();
+        });
+
+        ChunkPtr<T> chunk;
+        while (to_write.pop(chunk)) {
+
+            pending[chunk->index] = std::move(chunk);
+            while (!pending.empty() && pending.begin()->first == next) {
+
+                write(*pending.begin()->second);
+                ncps += pending.begin()->second->ids.size();
+                pending.erase(pending.begin());
+                next++;
+            }
+        }
+
+        reader.join();
+        closer.join();
+        return ncps;
+    }
+}
+#endif
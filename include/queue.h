@@ -0,0 +1,72 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+#ifndef _QUEUE_H_
+#define _QUEUE_H_
+
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+
+// -----------------------------------------------------------------------
+// A thread-safe FIFO queue with a fixed capacity.
+// push blocks while the queue is full, and pop blocks while it is empty.
+// once closed, push fails and pop drains the remaining items.
+// -----------------------------------------------------------------------
+template <typename T>
+class BoundedQueue {
+
+    std::queue<T> items;
+    const size_t capacity;
+    bool closed;
+
+    std::mutex mtx;
+    std::condition_variable not_full, not_empty;
+
+public:
+    explicit BoundedQueue(size_t capacity_) : capacity(capacity_ > 0 ? capacity_ : 1), closed(false) {}
+
+    bool push(T item) {
+
+        std::unique_lock<std::mutex> lock(mtx);
+        not_full.wait(lock, [this]() { return closed || items.size() < capacity; });
+        if(closed)
+            return false;
+
+        items.push(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(T &item) {
+
+        std::unique_lock<std::mutex> lock(mtx);
+        not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+        if(items.empty())
+            return false;
+
+        item = std::move(items.front());
+        items.pop();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+};
+#endif
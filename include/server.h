@@ -0,0 +1,43 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <string>
+#include <cstddef>
+
+// -----------------------------------------------------------------------
+// A long-running detection server on a Unix domain socket.
+//
+// Every request is one line with the arguments of a command line run, e.g.,
+//      --stencil=6 --roi=10:20,0:8,5:9 field.txt 64 64 64
+// and the reply is "ok N" followed by N lines "simplex_id x y z" (as in the
+// output files), or a line "error message". The request "shutdown" stops the
+// server. A client that sends a line longer than a few KiB is dropped.
+//
+// The most recently used datasets stay in memory, together with their critical
+// points for every set of options that changes the result. A region of interest
+// is then answered by selecting the simplices of the region, which gives the
+// same result as detecting in the region only.
+//
+// The requests are served one after the other, since the SoS library is not
+// thread-safe, but any number of clients can stay connected.
+// -----------------------------------------------------------------------
+namespace Server {
+
+    // serve requests on the socket at path, keeping at most max_datasets datasets in memory
+    void run(const std::string &path, size_t max_datasets);
+}
+#endif
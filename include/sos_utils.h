@@ -71,7 +71,7 @@ public:
 
         // correct if vj vk are out of order
         if( sos_smaller( vk, 2, vj, 2 ) )
-            return intersect_halfline( vi, vk, vj );
+            std::swap( vj, vk );
 
         // ---------------
         if( sos_smaller( vj, 2, vi, 2 ) && sos_smaller( vi, 2, vk, 2 ) ){
@@ -85,6 +85,28 @@ public:
         else return 0;
     }
 
+    // same as above, but the SoS order of the y components is given by precomputed ranks
+    // i.e., rank[va] < rank[vb] iff sos_smaller( va, 2, vb, 2 )
+    static int intersect_halfline( int vi, int vj, int vk, const int *rank ){
+
+        int result, s, d;
+
+        // correct if vj vk are out of order
+        if( rank[vk] < rank[vj] )
+            std::swap( vj, vk );
+
+        // ---------------
+        if( rank[vj] < rank[vi] && rank[vi] < rank[vk] ){
+
+            s = basic_isort3 (&vi, &vj, &vk);
+            d = sos_lambda3 (vi, vj, vk) -> signum;
+            result = If (Odd (s), (d == -1), (d == 1));
+
+            return result;
+        }
+        else return 0;
+    }
+
     static int is_smaller(int va, int i, int vb, int j){
 
         if( va > vb )
@@ -182,6 +204,19 @@ public:
 
         return 0;
     }
+    static int point_in_triangle(int p, int v1, int v2, int v3, const int *rank ){
+
+        int count = 0;
+
+        if( intersect_halfline (p, v1, v2, rank) )    count++;
+        if( intersect_halfline (p, v2, v3, rank) )    count++;
+        if( intersect_halfline (p, v3, v1, rank) )    count++;
+
+        if ( Odd( count) )
+            return 1;
+
+        return 0;
+    }
     static int point_in_tet(int p, int v1, int v2, int v3, int v4 ){
 
         //printf(" point in tet (%d %d %d %d %d)\n", p, v1, v2, v3, v4);
@@ -0,0 +1,258 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+#ifndef _STENCIL_H_
+#define _STENCIL_H_
+
+#include <vector>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include "vec.h"
+
+// -----------------------------------------------------------------------
+// Subdivision schemes for the cells of a regular grid.
+//
+// The corners of a cell (quad or cube) are numbered by their offset from the
+// cell origin: bit 0 is +x, bit 1 is +y, and bit 2 is +z. Hence, corner 0 is
+// the origin, corner 3 is diagonally opposite in the xy plane, and corner 7
+// is diagonally opposite in the cube.
+//
+// simplices[p][k] lists the corners of the k-th simplex of a cell of
+// parity p, where the parity of a cell is (i+j+k) mod nparities.
+// -----------------------------------------------------------------------
+
+// 2 triangles per quad
+struct Tri2 {
+    static constexpr int dim = 2;
+    static constexpr int ncorners = 4;
+    static constexpr int nsimplices = 2;
+    static constexpr int nparities = 1;
+    static constexpr int simplices[nparities][nsimplices][dim+1] = {
+        { {0,1,3}, {0,3,2} }
+    };
+};
+
+// 5 tets per cube : http://www.ics.uci.edu/~eppstein/projects/tetra/
+// the decomposition is mirrored in x for odd cubes, so that the diagonals of
+// the shared faces match between neighboring cubes
+struct Tet5 {
+    static constexpr int dim = 3;
+    static constexpr int ncorners = 8;
+    static constexpr int nsimplices = 5;
+    static constexpr int nparities = 2;
+    static constexpr int simplices[nparities][nsimplices][dim+1] = {
+        { {0,1,4,2}, {5,7,4,1}, {6,4,2,7}, {3,7,1,2}, {4,1,7,2} },
+        { {1,0,5,3}, {4,6,5,0}, {7,5,3,6}, {2,6,0,3}, {5,0,6,3} }
+    };
+};
+
+// 6 tets per cube (Freudenthal/Kuhn): all tets share the main diagonal 0-7
+struct Tet6 {
+    static constexpr int dim = 3;
+    static constexpr int ncorners = 8;
+    static constexpr int nsimplices = 6;
+    static constexpr int nparities = 1;
+    static constexpr int simplices[nparities][nsimplices][dim+1] = {
+        { {0,1,3,7}, {0,1,5,7}, {0,2,3,7}, {0,2,6,7}, {0,4,5,7}, {0,4,6,7} }
+    };
+};
+
+// -----------------------------------------------------------------------
+// A regular grid whose cells are subdivided using a stencil.
+// Simplices are never stored; simplex s is the (s % nsimplices)-th simplex of
+// cell (s / nsimplices), and cells are ordered by slice, row, and column.
+//
+// Along a periodic axis, the last layer of cells wraps around to the first
+// layer of vertices, so the field never needs to be padded. A stencil with
+// alternating parities needs an even number of cells along a periodic axis,
+// and a grid that does not conform is never built.
+// -----------------------------------------------------------------------
+template <typename Stencil>
+class StructuredGrid {
+
+    size_t X, Y, Z;         // number of vertices
+    size_t CX, CY, CZ;      // number of cells
+    bool periodic[3];
+
+    // when the grid is a block of a larger grid
+    size_t offset[3];       // index of the first vertex in the global grid
+    size_t GCX, GCY;        // number of cells of the global grid
+
+public:
+    typedef Vec<Stencil::dim+1, size_t> simplex_t;
+
+    StructuredGrid(const std::vector<size_t> &dims, const std::vector<bool> &periodic_ = std::vector<bool>()) :
+        X(dims[0]), Y(dims[1]), Z(Stencil::dim == 3 ? dims[2] : 1) {
+
+        for(int a = 0; a < 3; a++)
+            periodic[a] = (a < Stencil::dim) && (a < int(periodic_.size())) && periodic_[a];
+
+        CX = periodic[0] ? X : ((X > 1) ? X-1 : 0);
+        CY = periodic[1] ? Y : ((Y > 1) ? Y-1 : 0);
+        CZ = (Stencil::dim == 2) ? 1 : (periodic[2] ? Z : ((Z > 1) ? Z-1 : 0));
+
+        offset[0] = offset[1] = offset[2] = 0;
+        GCX = CX;   GCY = CY;
+
+        if(!is_conforming(dims, periodic_)){
+            std::cerr << " The " << Stencil::nsimplices << "-tet stencil does not match across a periodic axis"
+                      << " with an odd number of cells. Use --stencil=6!" << std::endl;
+            exit(1);
+        }
+    }
+
+    // place this grid as a block of a larger grid. the parity of the cells and
+    // the global ids of the simplices follow the global grid. the block may be
+    // periodic only along the axes it spans completely
+    void set_global_extent(const std::vector<size_t> &offset_, const std::vector<size_t> &global_dims) {
+
+        for(int a = 0; a < 3; a++)
+            offset[a] = (a < int(offset_.size())) ? offset_[a] : 0;
+        GCX = periodic[0] ? global_dims[0] : global_dims[0]-1;
+        GCY = periodic[1] ? global_dims[1] : global_dims[1]-1;
+    }
+
+    // id of the s-th simplex in the global grid
+    size_t global_id(size_t s) const {
+
+        const size_t c = s / Stencil::nsimplices;
+        const size_t gc = GCX*GCY*(c / (CX*CY) + offset[2]) + GCX*((c / CX) % CY + offset[1]) + (c % CX + offset[0]);
+        return gc*Stencil::nsimplices + s % Stencil::nsimplices;
+    }
+
+    size_t num_vertices() const {   return X*Y*Z;   }
+    size_t num_cells() const {      return CX*CY*CZ;   }
+    size_t num_simplices() const {  return num_cells()*Stencil::nsimplices;   }
+
+    // number of vertices and cells along an axis
+    size_t num_vertices(int axis) const {   return (axis == 0) ? X : ((axis == 1) ? Y : Z);     }
+    size_t num_cells(int axis) const {      return (axis == 0) ? CX : ((axis == 1) ? CY : CZ);  }
+    bool is_periodic(int axis) const {      return periodic[axis];  }
+
+    // a stencil with alternating parities is consistent across a periodic
+    // boundary only if the number of cells along that axis is even. along a
+    // periodic axis, the number of cells is the number of vertices
+    static bool is_conforming(const std::vector<size_t> &dims, const std::vector<bool> &periodic_) {
+        if(Stencil::nparities == 1)
+            return true;
+        for(int a = 0; a < Stencil::dim && a < int(periodic_.size()); a++){
+            if(periodic_[a] && (dims[a] % Stencil::nparities) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    // vertex id at (col, row, slice), which may be one past the last vertex of a periodic axis
+    size_t vertex(size_t col, size_t row, size_t slice) const {
+
+        if(col == X)    col = 0;
+        if(row == Y)    row = 0;
+        if(slice == Z)  slice = 0;
+        return X*Y*slice + X*row + col;
+    }
+
+    // vertex ids of the corners of the cell at (col, row, slice)
+    // returns the parity of the cell
+    int cell_corners(size_t col, size_t row, size_t slice, size_t *corners) const {
+
+        for(int c = 0; c < Stencil::ncorners; c++){
+            corners[c] = vertex(col + (c&1), row + ((c>>1)&1), slice + ((c>>2)&1));
+        }
+        return int((col + row + slice + offset[0] + offset[1] + offset[2]) % Stencil::nparities);
+    }
+
+    // vertex ids of the s-th simplex
+    simplex_t operator [] (size_t s) const {
+
+        const size_t c = s / Stencil::nsimplices;
+        const int k = int(s % Stencil::nsimplices);
+
+        size_t corners[Stencil::ncorners];
+        int p = cell_corners(c % CX, (c / CX) % CY, c / (CX*CY), corners);
+
+        simplex_t simplex;
+        for(int i = 0; i <= Stencil::dim; i++)
+            simplex[i] = corners[ Stencil::simplices[p][k][i] ];
+        return simplex;
+    }
+
+    // positions of the corners of the s-th simplex. corners that wrap around a
+    // periodic axis are shifted by the period, which is measured along the first line of vertices
+    void simplex_points(size_t s, const std::vector<point> &points, point *pos) const {
+
+        const size_t c = s / Stencil::nsimplices;
+        const int k = int(s % Stencil::nsimplices);
+        const size_t col = c % CX, row = (c / CX) % CY, slice = c / (CX*CY);
+
+        size_t corners[Stencil::ncorners];
+        int p = cell_corners(col, row, slice, corners);
+
+        const size_t ijk[3] = {col, row, slice};
+        const size_t stride[3] = {1, X, X*Y};
+
+        for(int i = 0; i <= Stencil::dim; i++){
+
+            const int corner = Stencil::simplices[p][k][i];
+            pos[i] = points[corners[corner]];
+
+            for(int a = 0; a < Stencil::dim; a++){
+
+                const size_t n = num_vertices(a);
+                if(!periodic[a] || ((corner>>a)&1) == 0 || ijk[a]+1 != n)
+                    continue;
+
+                pos[i] += (points[stride[a]*(n-1)] - points[0]) + (points[stride[a]] - points[0]);
+            }
+        }
+    }
+
+    // centroid of the s-th simplex
+    point centroid(size_t s, const std::vector<point> &points) const {
+
+        point pos[Stencil::dim+1];
+        simplex_points(s, points, pos);
+
+        point centroid;
+        for(int i = 0; i <= Stencil::dim; i++)
+            centroid += pos[i];
+        return centroid / double(Stencil::dim+1);
+    }
+
+    // call f(cell_id, corners, parity) for every cell in order
+    template <typename F>
+    void for_each_cell(F f) const {
+        for_each_cell(f, 0, num_cells(Stencil::dim-1));
+    }
+
+    // the same, for the cells in the layers [first, last) along the last axis
+    // (slices in 3D, rows in 2D)
+    template <typename F>
+    void for_each_cell(F f, size_t first, size_t last) const {
+
+        const size_t z0 = (Stencil::dim == 3) ? first : 0, z1 = (Stencil::dim == 3) ? last : CZ;
+        const size_t y0 = (Stencil::dim == 2) ? first : 0, y1 = (Stencil::dim == 2) ? last : CY;
+
+        size_t corners[Stencil::ncorners];
+        for(size_t slice = z0; slice < z1; slice++){
+        for(size_t row = y0; row < y1; row++){
+            size_t c = CX*(CY*slice + row);
+            for(size_t col = 0; col < CX; col++, c++){
+                int p = cell_corners(col, row, slice, corners);
+                f(c, corners, p);
+            }
+        }
+        }
+    }
+};
+#endif
@@ -0,0 +1,341 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+
+#ifndef _TRACKING_H_
+#define _TRACKING_H_
+
+#include <vector>
+#include <array>
+#include <utility>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include "vec.h"
+#include "CP.h"
+#include "stencil.h"
+
+// -----------------------------------------------------------------------
+// Tracking of critical points over the timesteps of a vector field on a
+// regular grid, in one pass over a space-time mesh.
+//
+// Two consecutive timesteps span a layer of space-time prisms, one over every
+// simplex of the grid. The prism over the simplex a0 < ... < ad (by vertex id),
+// whose copies at the next timestep are b0 ... bd, is split into the d+1
+// simplices {a0..ai, bi..bd}. The split of a face depends only on the order of
+// its own vertices, so neighboring prisms agree on their shared faces.
+//
+// Over a space-time simplex, the zeros of the (linearly interpolated) field
+// form a segment, which crosses exactly two of its facets, or none. A facet
+// has d+1 vertices with d components, so it crosses the zeros exactly when
+// the robust test of a critical point holds for it. Hence, the facets that
+// pass the test are the nodes of the tracks, and every space-time simplex
+// links the two such facets it has. The facets within a timestep are its
+// critical points. They are tested in both layers that share the timestep,
+// with their vertices in the same order, so the tracks continue across layers.
+//
+// A track may turn back in time (where two critical points are born or
+// annihilate), or close on itself.
+// -----------------------------------------------------------------------
+namespace Tracking {
+
+    struct Tracks {
+        std::vector<size_t> offsets;    // track k has the nodes offsets[k] ... offsets[k+1]-1
+        std::vector<point> points;      // centroid of the facet of every node
+        std::vector<double> times;      // ... and its time, in timesteps
+
+        Tracks() : offsets(1, 0) {}
+        size_t size() const {   return offsets.size()-1;    }
+    };
+
+    template <typename Stencil, typename T>
+    class Tracker {
+
+        static constexpr int D = Stencil::dim;
+        static constexpr size_t NONE = size_t(-1);
+
+        // a facet, as the space-time ids (t*V + v) of its vertices in increasing order
+        typedef std::array<size_t, D+1> facet_t;
+
+        // a facet that passes the filter, in one simplex of the current layer
+        struct Crossing {
+            facet_t facet;
+            size_t simplex;
+            point centroid;
+            double time;
+            bool operator < (const Crossing &c) const {   return facet < c.facet;   }
+        };
+
+        const StructuredGrid<Stencil> &grid;
+        const std::vector<point> &points;
+        const size_t V;
+
+        size_t nsteps;                                      // timesteps added so far
+        std::vector<Vec<3,T> > values;                      // the last two timesteps
+        std::vector<std::pair<facet_t, size_t> > last;      // the nodes within the last timestep
+
+        std::vector<point> nodes;
+        std::vector<double> times;
+        std::vector<std::pair<size_t, size_t> > edges;
+        size_t ninconsistent;                               // simplices with other than 0 or 2 crossings
+
+        void detect_layer(bool quiet);
+
+    public:
+        Tracker(const StructuredGrid<Stencil> &grid_, const std::vector<point> &points_) :
+            grid(grid_), points(points_), V(grid_.num_vertices()), nsteps(0), ninconsistent(0) {}
+
+        // a layer (two timesteps) must fit in one SoS matrix
+        static size_t max_vertices() {  return CPDetector<T>::MAX_VERTICES / 2;   }
+
+        // add the next timestep, and detect the crossings of the layer it closes
+        void add(const std::vector<Vec<3,T> > &vfield, bool quiet = false);
+
+        // connect the crossings into tracks
+        void tracks(Tracks &out) const;
+    };
+
+    // -------------------------------------------------------------------
+    template <typename Stencil, typename T>
+    void Tracker<Stencil, T>::add(const std::vector<Vec<3,T> > &vfield, bool quiet) {
+
+        if(nsteps == 0){
+            values.assign(2*V, Vec<3,T>());
+            std::copy(vfield.begin(), vfield.end(), values.begin());
+        }
+        else {
+            std::copy(vfield.begin(), vfield.end(), values.begin() + V);
+            detect_layer(quiet);
+            std::copy(values.begin() + V, values.end(), values.begin());
+        }
+        nsteps++;
+    }
+
+    template <typename Stencil, typename T>
+    void Tracker<Stencil, T>::detect_layer(bool quiet) {
+
+        const size_t t = nsteps-1;
+        const size_t base = t*V;
+
+        if(!quiet){
+            printf(" Tracking %dD Critical Points between timesteps %ld and %ld..", D, t, t+1);
+            fflush(stdout);
+        }
+
+        CPDetector<T> *CPD = new CPDetector<T>(&values, D);
+        CPD->set_quiet(quiet);
+
+        std::vector<Crossing> crossings;
+        std::vector<uint8_t> used (values.size(), 0);
+
+        grid.for_each_cell([&](size_t c, const size_t *v, int p) {
+
+            for(int k = 0; k < Stencil::nsimplices; k++){
+
+                // the corners of the simplex in the order of their ids
+                size_t a[D+1];
+                int order[D+1];
+                for(int i = 0; i <= D; i++){
+                    a[i] = v[Stencil::simplices[p][k][i]];
+                    order[i] = i;
+                }
+                std::sort(order, order+D+1, [&a](int x, int y) {   return a[x] < a[y];   });
+
+                const size_t s = c*Stencil::nsimplices + k;
+                point pos[D+1];
+                bool have_pos = false;
+
+                for(int i = 0; i <= D; i++){
+
+                    // the i-th simplex of the prism. vertex j is corner corner[j] at time t + later[j]
+                    size_t sv[D+2];
+                    int corner[D+2], later[D+2];
+                    for(int j = 0; j <= D+1; j++){
+                        corner[j] = order[(j <= i) ? j : j-1];
+                        later[j] = (j > i);
+                        sv[j] = a[corner[j]] + later[j]*V;
+                    }
+                    if(!CPDetector<T>::may_contain_zero(values, sv, D+2, D))
+                        continue;
+
+                    // its facets, without vertex f
+                    for(int f = 0; f <= D+1; f++){
+
+                        size_t fv[D+1];
+                        for(int j = 0, n = 0; j <= D+1; j++)
+                            if(j != f)  fv[n++] = sv[j];
+
+                        if(!CPDetector<T>::may_contain_zero(values, fv, D+1, D))
+                            continue;
+
+                        if(!have_pos){
+                            grid.simplex_points(s, points, pos);
+                            have_pos = true;
+                        }
+
+                        Crossing x;
+                        x.simplex = s*(D+1) + i;
+                        int nlater = 0;
+                        for(int j = 0, n = 0; j <= D+1; j++){
+                            if(j == f)
+                                continue;
+                            x.facet[n++] = base + sv[j];
+                            x.centroid += pos[corner[j]];
+                            nlater += later[j];
+                            used[sv[j]] = 1;
+                        }
+                        x.centroid = x.centroid / double(D+1);
+                        x.time = double(t) + double(nlater) / double(D+1);
+                        crossings.push_back(x);
+                    }
+                }
+            }
+        });
+
+        CPD->load(&used);
+        std::vector<uint8_t>().swap(used);
+
+        // test every facet once, and link the simplices that have it to its node
+        std::sort(crossings.begin(), crossings.end());
+
+        std::vector<std::pair<size_t, size_t> > links;
+        std::vector<std::pair<facet_t, size_t> > next;
+        size_t ntests = 0, nzeros = 0;
+
+        for(size_t i = 0; i < crossings.size(); ){
+
+            const facet_t &facet = crossings[i].facet;
+            size_t j = i;
+            while(j < crossings.size() && crossings[j].facet == facet)
+                j++;
+
+            size_t fv[D+1];
+            for(int n = 0; n <= D; n++)
+                fv[n] = facet[n] - base;
+
+            ntests++;
+            if(CPD->contains_zero(fv)){
+
+                nzeros++;
+                const bool at_first = (facet[D] < base + V);
+                const bool at_second = (facet[0] >= base + V);
+
+                // a facet within timestep t was found in the previous layer
+                size_t node = NONE;
+                if(at_first && t > 0){
+                    typename std::vector<std::pair<facet_t, size_t> >::const_iterator it =
+                        std::lower_bound(last.begin(), last.end(), std::make_pair(facet, size_t(0)));
+                    if(it != last.end() && it->first == facet)
+                        node = it->second;
+                }
+                if(node == NONE){
+                    node = nodes.size();
+                    nodes.push_back(crossings[i].centroid);
+                    times.push_back(crossings[i].time);
+                }
+                if(at_second)
+                    next.push_back(std::make_pair(facet, node));
+
+                for(size_t r = i; r < j; r++)
+                    links.push_back(std::make_pair(crossings[r].simplex, node));
+            }
+            i = j;
+        }
+        last.swap(next);
+        delete CPD;
+
+        // every space-time simplex links the two facets that it has
+        std::sort(links.begin(), links.end());
+        for(size_t i = 0; i < links.size(); ){
+
+            size_t j = i;
+            while(j < links.size() && links[j].first == links[i].first)
+                j++;
+
+            if(j-i == 2)
+                edges.push_back(std::make_pair(links[i].second, links[i+1].second));
+            else
+                ninconsistent++;
+            i = j;
+        }
+
+        if(!quiet)
+            printf(" Found %ld crossings! (%ld exact tests)\n", nzeros, ntests);
+    }
+
+    template <typename Stencil, typename T>
+    void Tracker<Stencil, T>::tracks(Tracks &out) const {
+
+        const size_t n = nodes.size();
+
+        // the crossings have at most two neighbors: the simplices on either side
+        std::vector<size_t> adj (2*n, NONE);
+        size_t nextra = 0;
+        for(size_t e = 0; e < edges.size(); e++){
+
+            const size_t a = edges[e].first, b = edges[e].second;
+            size_t *sa = (adj[2*a] == NONE) ? &adj[2*a] : &adj[2*a+1];
+            size_t *sb = (adj[2*b] == NONE) ? &adj[2*b] : &adj[2*b+1];
+            if(*sa != NONE || *sb != NONE){
+                nextra++;
+                continue;
+            }
+            *sa = b;
+            *sb = a;
+        }
+
+        std::vector<uint8_t> visited (n, 0);
+        out = Tracks();
+
+        // follow a track from node start, until it ends (or closes)
+        auto follow = [&](size_t start) {
+
+            size_t cur = start;
+            while(cur != NONE){
+
+                visited[cur] = 1;
+                out.points.push_back(nodes[cur]);
+                out.times.push_back(times[cur]);
+
+                size_t nxt = NONE;
+                for(int i = 0; i < 2; i++){
+                    const size_t m = adj[2*cur+i];
+                    if(m != NONE && !visited[m])
+                        nxt = m;
+                }
+                if(nxt == NONE && (adj[2*cur] == start || adj[2*cur+1] == start) && out.points.size() - out.offsets.back() > 2){
+                    out.points.push_back(nodes[start]);
+                    out.times.push_back(times[start]);
+                }
+                cur = nxt;
+            }
+            out.offsets.push_back(out.points.size());
+        };
+
+        // the open tracks start at an end, and the rest are closed
+        for(size_t i = 0; i < n; i++){
+            if(!visited[i] && (adj[2*i] == NONE || adj[2*i+1] == NONE))
+                follow(i);
+        }
+        for(size_t i = 0; i < n; i++){
+            if(!visited[i])
+                follow(i);
+        }
+
+        if(ninconsistent > 0 || nextra > 0)
+            printf(" Tracking: %ld space-time simplices without a pair of crossings, and %ld extra links were skipped\n",
+                   ninconsistent, nextra);
+    }
+}
+#endif
@@ -0,0 +1,39 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+
+#ifndef _VALIDATE_H_
+#define _VALIDATE_H_
+
+#include <cstddef>
+
+// -----------------------------------------------------------------------
+// Differential validation of the fast paths of the detector.
+//
+// Every trial fills a small regular grid (a random stencil, size, and set of
+// periodic axes) with a random or a degenerate field: integer vectors, exact
+// zeros, duplicated vertices, or values at the threshold of the filter. The
+// values are representable in single precision.
+//
+// The reference tests every simplex with the SoSUtils predicates, with all the
+// vertices loaded, and without the filter, the 2D ranks, the edge sweep, or
+// tiles. Every accelerated configuration must report exactly the same
+// simplices. A disagreement is reported with the simplex, and is written as
+// a raw file of the field and a single-simplex mesh that reproduce it.
+// -----------------------------------------------------------------------
+namespace Validate {
+
+    // run ntrials trials (trial t uses seed t). returns the number of disagreements
+    size_t run(size_t ntrials);
+}
+#endif
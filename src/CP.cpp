@@ -11,11 +11,17 @@
  For more details on the Licence, please read LICENCE file.
 */
 
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
 #include "CP.h"
+#include "parallel.h"
 
 // -----------------------------------------------------------------------
-// Initialize SoS
-bool CPDetector::createSoS(bool verbose){
+// Initialize SoS with the vertices marked in used (all if null), which are
+// given consecutive rows in the order of their ids
+template <typename T>
+bool CPDetector<T>::createSoS(const std::vector<uint8_t> *used, bool verbose){
 
 #ifndef USE_SOS
     return true;
@@ -25,10 +31,40 @@ bool CPDetector::createSoS(bool verbose){
         printf(" createSOS -- null vector field received!\n");
         return false;
     }
-    if(vfield->empty()){
+    if(nverts == 0){
         printf(" createSOS -- empty vector field received!\n");
         return false;
     }
+
+    size_t vsz = nverts;
+    if(used){
+        vsz = 0;
+        for(size_t v = 0; v < nverts; v++)
+            vsz += (*used)[v];
+    }
+
+    // the rows after the vertices are the targets, or zero
+    const size_t ntargets = targets.empty() ? 1 : targets.size();
+    if(vsz + ntargets > MAX_VERTICES + 1){
+        std::cerr << " createSOS -- " << vsz << " vertices exceed the SoS limit of " << MAX_VERTICES
+                  << " per detector. Split the data into blocks!\n";
+        exit(1);
+    }
+
+    sos_row.clear();
+    if(used){
+        sos_row.assign(nverts, 0);
+        int r = 0;
+        for(size_t v = 0; v < nverts; v++){
+            if((*used)[v])
+                sos_row[v] = ++r;
+        }
+    }
+
+    // no simplex passed the filter
+    if(vsz == 0)
+        return true;
+
     if(dim != 2 && dim != 3){
         printf(" createSOS -- invalid dimension %d\n", dim);
        return false;
@@ -37,7 +73,6 @@ bool CPDetector::createSoS(bool verbose){
     if(verbose)
         printf(" -------------- Creating SOS Matrix ........... ");
 
-    uint vsz = vfield->size();
     static int lia_count = 1;
 
     if( !sos_is_down() ){
@@ -53,13 +88,13 @@ bool CPDetector::createSoS(bool verbose){
     sm.title = NULL;
     sm.lines = 0;
 
-    sm.data_size = vsz+1;           // no of values + one for ZERO_IND
+    sm.data_size = int(vsz+ntargets);   // no of values + the targets (or ZERO_IND)
     sm.data_dim  = dim;            // dim of points
     //sm.simp_size = H_U.size();    // no of simplices
     //sm.simp_dim  = 1;             // dim of simplices
 
-    sm.fix_w = 15;
-    sm.fix_a = 14;
+    sm.fix_w = SOS_FIX_W;
+    sm.fix_a = SOS_FIX_A;
 
     sm.scale = 1.0;     //ie, no scaling
     sm.decimals = 10;   //ie, int coordinates
@@ -93,34 +128,131 @@ bool CPDetector::createSoS(bool verbose){
                Lia_DIGITS (2 * sm.decimals + 1));
 
    //printf(" lia_limit now!!\n");
-   lia_stack_limit( lia_count*((sm.data_size+1) * sm.data_dim));
+   const size_t stack_size = size_t(lia_count) * (size_t(sm.data_size)+1) * size_t(sm.data_dim);
+   lia_stack_limit( int(std::min(stack_size, size_t(INT_MAX))) );
+
+    // in 2D, keep the quantized y components to rank them
+   std::vector<double> yvalues;
+   if(dim == 2)
+       yvalues.resize(sm.data_size+1, 0.0);
 
     // --------------------
-   for(uint v = 0; v < vsz; v++){
-   for(uint d = 0; d < sm.data_dim; d++){
-      SoSUtils::ffp_param_push2 (v+1, d+1, SoSUtils::float_to_fixed(vfield->at(v)[d], sm.fix_a), sm.fix_w, sm.fix_a);
-      //printf(" adding to SoS [%d][%d] %f %f\n", v+1, d+1, vfield->at(v)[d], SoSUtils::float_to_fixed(vfield->at(v)[d], sm.fix_a));
+   for(size_t v = 0; v < nverts; v++){
+
+      const int r = row(v);
+      if(r == 0)
+          continue;
+
+      for(int d = 0; d < sm.data_dim; d++){
+         const double q = SoSUtils::float_to_fixed(vfield[v][d], sm.fix_a);
+         SoSUtils::ffp_param_push2 (r, d+1, q, sm.fix_w, sm.fix_a);
+         //printf(" adding to SoS [%d][%d] %f %f\n", r, d+1, vfield[v][d], SoSUtils::float_to_fixed(vfield[v][d], sm.fix_a));
+         if(d == 1 && !yvalues.empty())
+             yvalues[r] = q;
+      }
    }
+
+    // give the last indices to zero, or to the targets
+   SOS_ZERO_IDX = int(vsz+1);
+
+   for(size_t k = 0; k < ntargets; k++){
+      const int r = int(SOS_ZERO_IDX + k);
+      for(int d = 0; d < sm.data_dim; d++){
+         //printf(" -- adding 0 to SoS [%d][%d] \n", ZERO_IND, d+1);
+         const double q = targets.empty() ? 0.0 : SoSUtils::float_to_fixed(targets[k][d], sm.fix_a);
+         SoSUtils::ffp_param_push2 (r, d+1, q, sm.fix_w, sm.fix_a);
+         if(d == 1 && !yvalues.empty())
+             yvalues[r] = q;
+      }
    }
 
-    // give the last index to zero
-   SOS_ZERO_IDX = sm.data_size;
+   sos_loaded = true;
 
-   for(uint d = 0; d < sm.data_dim; d++){
-       //printf(" -- adding 0 to SoS [%d][%d] \n", ZERO_IND, d+1);
-      SoSUtils::ffp_param_push2 (SOS_ZERO_IDX, d+1, 0.0, sm.fix_w, sm.fix_a);
-   }
+   if(!yvalues.empty() && ranks)
+       create_ranks(yvalues);
    return true;
 #endif
 }
 
 
-float CPDetector::sign (const point &p1, const point &p2, const point &p3){
+// -----------------------------------------------------------------------
+// Rank the SoS indices 1..n (the last is zero, or the last target) by the SoS order of their y components,
+// so that sos_smaller(a, 2, b, 2) becomes rank[a] < rank[b].
+// values are sorted by (quantized value, index). since SoS breaks ties by
+// index, the order is validated against sos_smaller for every adjacent pair,
+// which implies the whole order. if it does not match either direction of
+// tie-breaking, the ranks are dropped and sos_smaller is used instead.
+template <typename T>
+void CPDetector<T>::create_ranks(const std::vector<double> &yvalues) {
+
+#ifdef USE_SOS
+    const int n = int(yvalues.size()) - 1;
+
+    std::vector<int> order (n);
+    for(int i = 0; i < n; i++)
+        order[i] = i+1;
+
+    for(int tie = 0; tie < 2; tie++){
+
+        Parallel::sort(order.begin(), order.end(), [&yvalues, tie](int a, int b) {
+            if(yvalues[a] != yvalues[b])
+                return yvalues[a] < yvalues[b];
+            return (tie == 0) ? (a < b) : (b < a);
+        });
+
+        bool valid = true;
+        for(int i = 1; i < n && valid; i++)
+            valid = sos_smaller(order[i-1], 2, order[i], 2);
+
+        if(valid){
+            sos_rank.assign(n+1, 0);
+            for(int i = 0; i < n; i++)
+                sos_rank[order[i]] = i;
+            return;
+        }
+    }
+
+    if(!quiet)
+        printf(" CPDetector::create_ranks -- SoS order does not match the sorted values. Using sos_smaller!\n");
+    sos_rank.clear();
+#endif
+}
+
+// the vertex values of a tile take dim numbers each. a tile that fills half of
+// the L2 cache leaves room for the rows of the field that are copied into it
+template <typename T>
+void CPDetector<T>::tile_size(size_t t[3]) const {
+
+    if(!tile.empty()){
+        for(int a = 0; a < 3; a++)
+            t[a] = tile[std::min(size_t(a), tile.size()-1)];
+        if(dim == 2)
+            t[2] = 1;
+        return;
+    }
+
+    long l2 = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if(l2 <= 0)
+        l2 = 256*1024;
+
+    const double nverts = double(l2) / (2.0 * dim * sizeof(T));
+    const size_t edge = std::max(size_t(std::pow(nverts, 1.0/dim)), size_t(3)) - 1;
+
+    t[0] = t[1] = edge;
+    t[2] = (dim == 3) ? edge : 1;
+}
+
+template <typename T>
+float CPDetector<T>::sign (const point &p1, const point &p2, const point &p3){
     return 0;
 }
 
 #ifndef USE_SOS
-bool CPDetector::point_in_triangle(const point &p, const point &a, const point &b, const point &c) {
+template <typename T>
+bool CPDetector<T>::point_in_triangle(const point &p, const point &a, const point &b, const point &c) {
 
     std::cerr << "CPDetector::point_in_triangle not implemented without USE_SOS!\n";
     return false;
@@ -135,50 +267,246 @@ bool CPDetector::point_in_triangle(const point &p, const point &a, const point &
 #endif
 }
 
-bool CPDetector::point_in_tetrahedron(const point &p, const point &a, const point &b, const point &c, const point &d) {
+template <typename T>
+bool CPDetector<T>::point_in_tetrahedron(const point &p, const point &a, const point &b, const point &c, const point &d) {
     std::cerr << "CPDetector::point_in_tetrahedron not implemented without USE_SOS!\n";
     return false;
 }
 #endif
 
-void CPDetector::compute() {
+template <typename T>
+void CPDetector<T>::compute() {
 
-    printf("\n Detecting %dD Critical Points..", this->dim);
-    fflush(stdout);
+    if(!quiet){
+        printf("\n Detecting %dD Critical Points..", this->dim);
+        fflush(stdout);
+    }
 
     if(dim == 3 && tets != 0) {
+        compute_simplices<4>(tets->size(), [this](size_t t) {  return &(*tets)[t][0];  });
+    }
 
-        for(uint t = 0; t < tets->size(); t++){
+    else if(dim == 2 && tris != 0 && edge_sweep) {
+        compute_edge_sweep();
+    }
 
-            const ivec4 &tet = tets->at(t);
+    else if(dim == 2 && tris != 0) {
+        compute_simplices<3>(tris->size(), [this](size_t t) {  return &(*tris)[t][0];  });
+    }
 
-#ifdef USE_SOS
-            bool cp_found = SoSUtils::point_in_tet(SOS_ZERO_IDX, tet[0]+1, tet[1]+1, tet[2]+1, tet[3]+1);
-#else
-            bool cp_found = point_in_tetrahedron(point(0,0,0), vfield[tet[0]], vfield[tet[1]], vfield[tet[2]], vfield[tet[3]]);
-#endif
-            if(cp_found){
-                cp.push_back(t);
-            }
+    if(!quiet)
+        printf(" Detected %ld simplices with critical points!\n", cp.size());
+}
+
+// -----------------------------------------------------------------------
+template <typename T>
+void CPDetector<T>::compute(const MixedMesh &mesh) {
+
+    if(!quiet){
+        printf("\n Detecting %dD Critical Points in %'ld mixed cells..", this->dim, mesh.num_cells());
+        fflush(stdout);
+    }
+
+    Vec<4,int> tets[Cells::MAX_SIMPLICES];
+    Vec<3,int> tris[Cells::MAX_SIMPLICES];
+
+    // split cell c into simplices of this dimension. returns their number
+    auto split = [&](size_t c) {
+
+        const uint8_t type = mesh.types[c];
+        if(Cells::dim(type) != int(dim))
+            return 0;
+        return (dim == 3) ? Cells::split(type, mesh.cell(c), tets) : Cells::split(type, mesh.cell(c), tris);
+    };
+    auto simplex = [&](int k) -> const int* {
+        return (dim == 3) ? &tets[k][0] : &tris[k][0];
+    };
+
+    // the simplices that pass the filter, and their vertices
+    std::vector<size_t> candidates;
+    std::vector<uint8_t> used (filter ? nverts : 0, 0);
+
+    for(size_t c = 0; c < mesh.num_cells(); c++){
+
+        const int n = split(c);
+        for(int k = 0; k < n; k++){
+
+            if(filter && !may_contain_zero(vfield, simplex(k), dim+1, dim))
+                continue;
+
+            candidates.push_back(c*Cells::MAX_SIMPLICES + k);
+            if(filter)
+                mark(used, simplex(k), dim+1);
         }
     }
+    createSoS(filter ? &used : 0);
 
-    else if(dim == 2 && tris != 0) {
+    for(size_t i = 0; i < candidates.size(); i++){
+
+        split(candidates[i] / Cells::MAX_SIMPLICES);
+        if(contains_zero(simplex(int(candidates[i] % Cells::MAX_SIMPLICES))))
+            cp.push_back(candidates[i]);
+    }
+
+    if(!quiet)
+        printf(" Detected %ld simplices with critical points!\n", cp.size());
+}
+
+// -----------------------------------------------------------------------
+// 2D edge sweep
+// a triangle contains a cp iff the halfline from zero crosses an odd number
+// of its edges. an interior edge is shared by two triangles, so its crossing
+// is computed once and toggles the parity of both.
+// with the filter, only the vertices of the triangles that pass it are
+// loaded, and only the edges between loaded vertices are tested. the parity
+// is then exact for the candidates, which are the only triangles reported.
+// -----------------------------------------------------------------------
+template <typename T>
+void CPDetector<T>::compute_edge_sweep() {
+
+    struct Edge {
+        int a, b;
+        size_t t;
+        bool operator < (const Edge &e) const {
+            return (a != e.a) ? (a < e.a) : ((b != e.b) ? (b < e.b) : (t < e.t));
+        }
+    };
+
+    const size_t ntris = tris->size();
 
-        for(uint t = 0; t < tris->size(); t++){
+    std::vector<uint8_t> candidate (ntris, 1);
+    if(filter){
+        std::vector<uint8_t> used (nverts, 0);
+        for(size_t t = 0; t < ntris; t++){
+            candidate[t] = may_contain_zero(vfield, &(*tris)[t][0], 3, 2);
+            if(candidate[t])
+                mark(used, &(*tris)[t][0], 3);
+        }
+        createSoS(&used);
+    }
+    else
+        createSoS();
+
+    // collect the edges of all triangles, with sorted end points
+    std::vector<Edge> edges (3*ntris);
+    for(size_t t = 0; t < ntris; t++){
+
+        const ivec3 &tri = (*tris)[t];
+        for(int i = 0; i < 3; i++){
+
+            int a = tri[i], b = tri[(i+1)%3];
+            if(b < a)   std::swap(a,b);
+            edges[3*t+i] = {a, b, t};
+        }
+    }
+    Parallel::sort(edges.begin(), edges.end());
 
-            const ivec3 &tri = tris->at(t);
+    // test every unique edge once
+    std::vector<uint8_t> parity (ntris, 0);
+    for(size_t i = 0; i < edges.size(); ){
+
+        size_t j = i+1;
+        while(j < edges.size() && edges[j].a == edges[i].a && edges[j].b == edges[i].b)
+            j++;
 
 #ifdef USE_SOS
-            bool cp_found = SoSUtils::point_in_triangle(SOS_ZERO_IDX, tri[0]+1, tri[1]+1, tri[2]+1);
-#else
-            bool cp_found = point_in_triangle(point(0,0,0), vfield[tri[0]], vfield[tri[1]], vfield[tri[2]]);
+        const int ra = row(edges[i].a), rb = row(edges[i].b);
+        if( ra > 0 && rb > 0 && intersect_halfline(SOS_ZERO_IDX, ra, rb) ){
+            for(size_t k = i; k < j; k++)
+                parity[edges[k].t] ^= 1;
+        }
 #endif
-            if(cp_found){
-                cp.push_back(t);
+        i = j;
+    }
+
+    for(size_t t = 0; t < ntris; t++){
+        if(parity[t] && candidate[t])
+            cp.push_back(t);
+    }
+}
+
+// on a grid with the Tri2 stencil, the edges are enumerated implicitly.
+// triangle A = (0,1,3) and B = (0,3,2) of quad (col,row) are 2*q and 2*q+1.
+template <typename T>
+void CPDetector<T>::compute_edge_sweep(const StructuredGrid<Tri2> &grid) {
+
+    const size_t X = grid.num_vertices(0);
+    const size_t Y = grid.num_vertices(1);
+    const size_t CX = grid.num_cells(0);
+    const size_t CY = grid.num_cells(1);
+
+    std::vector<uint8_t> parity (grid.num_simplices(), 0);
+
+    // bit 1 of the parity marks the triangles that pass the filter
+    if(filter){
+        std::vector<uint8_t> used (nverts, 0);
+        grid.for_each_cell([&](size_t c, const size_t *v, int p) {
+            for(int k = 0; k < Tri2::nsimplices; k++){
+
+                size_t s[3];
+                for(int i = 0; i < 3; i++)
+                    s[i] = v[Tri2::simplices[p][k][i]];
+
+                if(may_contain_zero(vfield, s, 3, 2)){
+                    parity[2*c+k] = 2;
+                    mark(used, s, 3);
+                }
             }
+        });
+        createSoS(&used);
+    }
+    else {
+        std::fill(parity.begin(), parity.end(), 2);
+        createSoS();
+    }
+
+#ifdef USE_SOS
+    auto crosses = [this](size_t a, size_t b) {
+        const int ra = row(a), rb = row(b);
+        return ra > 0 && rb > 0 && intersect_halfline(SOS_ZERO_IDX, ra, rb);
+    };
+
+    // neighboring quad along an axis, wrapping around periodic axes
+    const bool px = grid.is_periodic(0), py = grid.is_periodic(1);
+    const size_t none = size_t(-1);
+
+    for(size_t row = 0; row < Y; row++){
+    for(size_t col = 0; col < X; col++){
+
+        const size_t v = grid.vertex(col, row, 0);
+        const size_t q = CX*row + col;
+
+        // horizontal edge (col,row)-(col+1,row): bottom of quad (col,row), top of quad (col,row-1)
+        if(col < CX && crosses(v, grid.vertex(col+1, row, 0))){
+
+            const size_t below = (row > 0) ? q-CX : (py ? CX*(CY-1) + col : none);
+            if(row < CY)        parity[2*q] ^= 1;
+            if(below != none)   parity[2*below+1] ^= 1;
         }
+
+        // vertical edge (col,row)-(col,row+1): left of quad (col,row), right of quad (col-1,row)
+        if(row < CY && crosses(v, grid.vertex(col, row+1, 0))){
+
+            const size_t left = (col > 0) ? q-1 : (px ? q + CX-1 : none);
+            if(col < CX)        parity[2*q+1] ^= 1;
+            if(left != none)    parity[2*left] ^= 1;
+        }
+
+        // diagonal edge (col,row)-(col+1,row+1): shared by both triangles of quad (col,row)
+        if(col < CX && row < CY && crosses(v, grid.vertex(col+1, row+1, 0))){
+            parity[2*q] ^= 1;
+            parity[2*q+1] ^= 1;
+        }
+    }
     }
+#endif
 
-    printf(" Detected %ld simplices with critical points!\n", cp.size());
+    for(size_t t = 0; t < parity.size(); t++){
+        if(parity[t] == 3)
+            cp.push_back(t);
+    }
 }
+
+// -----------------------------------------------------------------------
+template class CPDetector<double>;
+template class CPDetector<float>;
@@ -11,8 +11,13 @@
  For more details on the Licence, please read LICENCE file.
 */
 
+#include <sstream>
+#include <limits>
+#include <algorithm>
+#include <cmath>
 #include "vec.h"
 #include "RW.h"
+#include "numa.h"
 
 using namespace std;
 
@@ -44,7 +49,8 @@ int RW::count_columns(const string &filename) {
     return cnt;
 }
 
-void RW::read_text(std::vector<point> &points, vector<vec> &vfield, string filename, int vdim){
+template <typename T>
+void RW::read_text(std::vector<point> &points, vector<Vec<3,T> > &vfield, string filename, int vdim){
 
     ifstream infile(filename.c_str());
     if(!infile.is_open()){
@@ -58,10 +64,20 @@ void RW::read_text(std::vector<point> &points, vector<vec> &vfield, string filen
     fflush(stdout);
 
     vfield.clear();
+    read_text(infile, points, vfield, vdim, size_t(-1));
+
+    infile.close();
+    printf(" Done! Read %'ld vectors and points\n", vfield.size());
+}
+
+template <typename T>
+size_t RW::read_text(std::istream &infile, std::vector<point> &points, vector<Vec<3,T> > &vfield, int vdim, size_t count){
+
+    size_t n = 0;
     if(vdim == 3) {
 
         std::string str;
-        do {
+        for(; n < count; n++) {
 
             if( ! (infile >> str) )           break;
             double x = atof(str.c_str());
@@ -82,14 +98,13 @@ void RW::read_text(std::vector<point> &points, vector<vec> &vfield, string filen
             double vz = atof(str.c_str());
 
             points.push_back( point(x,y,z) );
-            vfield.push_back( vec(vx,vy,vz) );
-
-        } while (true);
+            vfield.push_back( Vec<3,T>(T(vx),T(vy),T(vz)) );
+        }
     }
     else if(vdim == 2) {
 
         std::string str;
-        do {
+        for(; n < count; n++) {
 
             if( ! (infile >> str) )           break;
             double x = atof(str.c_str());
@@ -104,13 +119,10 @@ void RW::read_text(std::vector<point> &points, vector<vec> &vfield, string filen
             double vy = atof(str.c_str());
 
             points.push_back( point(x,y,0) );
-            vfield.push_back( vec(vx,vy,0) );
-
-        } while (true);
+            vfield.push_back( Vec<3,T>(T(vx),T(vy),T(0)) );
+        }
     }
-
-    infile.close();
-    printf(" Done! Read %'ld vectors and points\n", vfield.size());
+    return n;
 }
 
 void RW::read_text(vector<ivec4> &tets, string filename){
@@ -184,82 +196,1167 @@ void RW::read_text(vector<ivec3> &tris, string filename){
     printf(" Done! Read %'ld tets\n", tris.size());
 }
 
+void RW::read_targets(std::vector<point> &targets, const std::string &filename, int vdim){
+
+    ifstream infile(filename.c_str());
+    if(!infile.is_open()){
+        cerr << "Unable to open file "<<filename<<endl;
+        exit(1);
+    }
+
+    targets.clear();
+
+    std::string line;
+    while(std::getline(infile, line)){
+
+        std::istringstream iss(line);
+        point target;
+        int d = 0;
+        for(; d < vdim && (iss >> target[d]); d++);
+
+        if(d == 0)
+            continue;
+        if(d < vdim){
+            cerr << " Invalid target \"" << line << "\" in " << filename << ": expected " << vdim << " components" << endl;
+            exit(1);
+        }
+        targets.push_back(target);
+    }
+    infile.close();
+
+    if(targets.empty()){
+        cerr << " No targets in " << filename << endl;
+        exit(1);
+    }
+}
+
+// -----------------------------------------------------------------------
+// partitioned and multi-block image data
+// only the (small) xml headers are parsed here; the data of each block is
+// read by read_vti
 // -----------------------------------------------------------------------
-vector<vec> RW::read_plot3d_q(string filename, int &x, int &y, int &z, int &dim){
 
-    ifstream qfile;     qfile.open(filename.c_str());
-    if(!qfile.is_open()){
+// value of an attribute in an xml tag
+static std::string xml_attribute(const string &tag, const string &name) {
+
+    const string key = " " + name + "=\"";
+    size_t pos = tag.find(key);
+    if (pos == string::npos)
+        return string();
+
+    pos += key.length();
+    return tag.substr(pos, tag.find('"', pos) - pos);
+}
+
+// all tags <name ...> in an xml string
+static vector<string> xml_tags(const string &xml, const string &name) {
+
+    vector<string> tags;
+    const string key = "<" + name + " ";
+    for (size_t pos = xml.find(key); pos != string::npos; pos = xml.find(key, pos+1)) {
+        tags.push_back(xml.substr(pos, xml.find('>', pos) - pos));
+    }
+    return tags;
+}
+
+template <typename T>
+static vector<T> parse_values(const string &str) {
+
+    vector<T> vals;
+    std::istringstream iss(str);
+    T v;
+    while (iss >> v)
+        vals.push_back(v);
+    return vals;
+}
+
+// read the whole file, or its first maxlen characters
+static string read_header(const string &filename, size_t maxlen = string::npos) {
+
+    ifstream infile(filename.c_str());
+    if(!infile.is_open()){
         cerr << "Unable to open file "<<filename<<endl;
         exit(1);
     }
 
-    // --------------------------------------
-    // read qfile
-    printf(" Read plot3d file %s...", filename.c_str());
+    string str;
+    if (maxlen == string::npos) {
+        std::stringstream ss;
+        ss << infile.rdbuf();
+        str = ss.str();
+    }
+    else {
+        str.resize(maxlen);
+        infile.read(&str[0], maxlen);
+        str.resize(infile.gcount());
+    }
+    infile.close();
+    return str;
+}
+
+static string directory_of(const string &filename) {
+    const size_t pos = filename.find_last_of('/');
+    return (pos == string::npos) ? string() : filename.substr(0, pos+1);
+}
+
+template <typename T>
+void RW::read_blocks_info(std::vector<GridBlock<T> > &blocks, std::vector<size_t> &global_dims, const std::string &filename) {
+
+    printf(" Read blocks of %s...", filename.c_str());
     fflush(stdout);
 
-    string str;
-    getline(qfile, str);    x = atoi(str.c_str());
-    getline(qfile, str);    y = atoi(str.c_str());
-    getline(qfile, str);    z = atoi(str.c_str());
-    getline(qfile, str);    dim = atoi(str.c_str());
+    const string xml = read_header(filename);
+    const string dir = directory_of(filename);
+
+    blocks.clear();
+    global_dims.clear();
+
+    // -------------------------------------------------------------------
+    // .pvti: pieces of one image, given by their extents in the whole extent
+    vector<string> ptags = xml_tags(xml, "PImageData");
+    if (!ptags.empty()) {
+
+        const vector<long> wext = parse_values<long>(xml_attribute(ptags[0], "WholeExtent"));
+        if (wext.size() != 6) {
+            cerr << " Invalid WholeExtent in " << filename << endl;
+            exit(1);
+        }
+
+        for (int a = 0; a < 3; a++)
+            global_dims.push_back(size_t(wext[2*a+1] - wext[2*a] + 1));
+
+        const vector<string> pieces = xml_tags(xml, "Piece");
+        for (size_t i = 0; i < pieces.size(); i++) {
+
+            const vector<long> ext = parse_values<long>(xml_attribute(pieces[i], "Extent"));
+            const string src = xml_attribute(pieces[i], "Source");
+            if (ext.size() != 6 || src.empty()) {
+                cerr << " Invalid Piece " << i << " in " << filename << endl;
+                exit(1);
+            }
+
+            GridBlock<T> b;
+            b.filename = dir + src;
+            for (int a = 0; a < 3; a++) {
+                b.dims.push_back(size_t(ext[2*a+1] - ext[2*a] + 1));
+                b.offset.push_back(size_t(ext[2*a] - wext[2*a]));
+            }
+            blocks.push_back(b);
+        }
+
+        printf(" Done! Found %ld pieces of [%ld x %ld x %ld]\n", blocks.size(), global_dims[0], global_dims[1], global_dims[2]);
+        return;
+    }
+
+    // -------------------------------------------------------------------
+    // .vtm: independent image blocks. if all of them have the same spacing
+    // and lie on one lattice, they are treated as pieces of one image
+    const vector<string> dtags = xml_tags(xml, "DataSet");
+
+    vector<vector<double> > origins, spacings;
+    vector<vector<long> > extents;
+
+    for (size_t i = 0; i < dtags.size(); i++) {
+
+        const string file = xml_attribute(dtags[i], "file");
+        if (file.empty())
+            continue;
+
+        GridBlock<T> b;
+        b.filename = dir + file;
+
+        const vector<string> itags = xml_tags(read_header(b.filename, 4096), "ImageData");
+        if (itags.empty()) {
+            cerr << " Block " << b.filename << " is not a vtk image data file!\n";
+            exit(1);
+        }
+
+        extents.push_back(parse_values<long>(xml_attribute(itags[0], "WholeExtent")));
+        origins.push_back(parse_values<double>(xml_attribute(itags[0], "Origin")));
+        spacings.push_back(parse_values<double>(xml_attribute(itags[0], "Spacing")));
+
+        if (extents.back().size() != 6 || origins.back().size() != 3 || spacings.back().size() != 3) {
+            cerr << " Invalid header in block " << b.filename << endl;
+            exit(1);
+        }
+
+        for (int a = 0; a < 3; a++)
+            b.dims.push_back(size_t(extents.back()[2*a+1] - extents.back()[2*a] + 1));
+        blocks.push_back(b);
+    }
+
+    if (blocks.empty()) {
+        cerr << " No blocks found in " << filename << endl;
+        exit(1);
+    }
+
+    // global lattice index of the first vertex of every block
+    vector<vector<double> > start (blocks.size(), vector<double>(3));
+    bool aligned = true;
+    for (size_t i = 0; i < blocks.size() && aligned; i++) {
+    for (int a = 0; a < 3 && aligned; a++) {
+
+        const double h = spacings[0][a];
+        start[i][a] = (origins[i][a] - origins[0][a]) / h + double(extents[i][2*a]);
+        aligned = (spacings[i][a] == h) && (fabs(start[i][a] - round(start[i][a])) < 1e-6);
+    }
+    }
+
+    if (aligned) {
+
+        vector<long> lo (3), hi (3);
+        for (int a = 0; a < 3; a++) {
+            lo[a] = long(round(start[0][a]));
+            hi[a] = lo[a] + long(blocks[0].dims[a]) - 1;
+            for (size_t i = 1; i < blocks.size(); i++) {
+                lo[a] = std::min(lo[a], long(round(start[i][a])));
+                hi[a] = std::max(hi[a], long(round(start[i][a])) + long(blocks[i].dims[a]) - 1);
+            }
+            global_dims.push_back(size_t(hi[a] - lo[a] + 1));
+        }
+
+        for (size_t i = 0; i < blocks.size(); i++) {
+            for (int a = 0; a < 3; a++)
+                blocks[i].offset.push_back(size_t(long(round(start[i][a])) - lo[a]));
+        }
+
+        printf(" Done! Found %ld blocks of [%ld x %ld x %ld]\n", blocks.size(), global_dims[0], global_dims[1], global_dims[2]);
+    }
+    else {
+        printf(" Done! Found %ld blocks on different lattices\n", blocks.size());
+    }
+}
+
+void RW::write_cp(const std::string &filename, const std::vector<size_t> &ids, const std::vector<point> &centroids) {
+
+    std::ofstream infile(filename.c_str());
+    if(!infile.is_open()){
+        std::cerr << "Unable to open file "<<filename<<std::endl;
+        exit(1);
+    }
+
+    printf(" Write critical points to file %s...", filename.c_str());
+    fflush(stdout);
+
+    for(size_t i = 0; i < ids.size(); i++){
+        const point &p = centroids[i];
+        infile << ids[i] << " " << p[0] << " " << p[1] << " " << p[2] << std::endl;
+    }
+    infile.close();
+    printf(" Done! Wrote %'ld critical points\n", ids.size());
+}
+
+void RW::write_cp_counts(const std::string &filename, const std::vector<size_t> &ids, const std::vector<size_t> &counts,
+                         const std::vector<point> &centroids) {
+
+    std::ofstream infile(filename.c_str());
+    if(!infile.is_open()){
+        std::cerr << "Unable to open file "<<filename<<std::endl;
+        exit(1);
+    }
+
+    printf(" Write critical point counts to file %s...", filename.c_str());
+    fflush(stdout);
+
+    for(size_t i = 0; i < ids.size(); i++){
+        const point &p = centroids[i];
+        infile << ids[i] << " " << counts[i] << " " << p[0] << " " << p[1] << " " << p[2] << std::endl;
+    }
+    infile.close();
+    printf(" Done! Wrote %'ld simplices\n", ids.size());
+}
+
+void RW::write_tracks(const std::string &filename, const std::vector<size_t> &offsets, const std::vector<point> &points,
+                      const std::vector<double> &times) {
+
+    std::ofstream infile(filename.c_str());
+    if(!infile.is_open()){
+        std::cerr << "Unable to open file "<<filename<<std::endl;
+        exit(1);
+    }
+
+    printf(" Write tracks to file %s...", filename.c_str());
+    fflush(stdout);
+
+    for(size_t k = 0; k+1 < offsets.size(); k++){
+        for(size_t i = offsets[k]; i < offsets[k+1]; i++){
+            const point &p = points[i];
+            infile << k << " " << p[0] << " " << p[1] << " " << p[2] << " " << times[i] << std::endl;
+        }
+    }
+    infile.close();
+    printf(" Done! Wrote %'ld tracks\n", offsets.size()-1);
+}
+
+void RW::write_cp(const std::string &filename, const std::vector<size_t> &cp, const MixedMesh &mesh, const std::vector<point> &points) {
+
+    std::ofstream infile(filename.c_str());
+    if(!infile.is_open()){
+        std::cerr << "Unable to open file "<<filename<<std::endl;
+        exit(1);
+    }
+
+    printf(" Write critical points to file %s...", filename.c_str());
+    fflush(stdout);
 
-    unsigned int sz = x*y*z;
+    Vec<4,int> tets[Cells::MAX_SIMPLICES];
+    Vec<3,int> tris[Cells::MAX_SIMPLICES];
 
-    vector<vec> vfield(sz);
-    for(unsigned int i = 0; i < sz; i++){
-    for(unsigned int j = 0; j < 3; j++){
-        getline(qfile, str);
-        vfield[i][j] = atof(str.c_str());
+    for(size_t i = 0; i < cp.size(); i++){
+
+        const size_t c = cp[i] / Cells::MAX_SIMPLICES;
+        const int k = int(cp[i] % Cells::MAX_SIMPLICES);
+        const uint8_t type = mesh.types[c];
+
+        point p;
+        if(Cells::dim(type) == 3){
+            Cells::split(type, mesh.cell(c), tets);
+            p = get_centroid(tets[k], points);
+        }
+        else {
+            Cells::split(type, mesh.cell(c), tris);
+            p = get_centroid(tris[k], points);
+        }
+
+        infile << c << " " << k << " " << p[0] << " " << p[1] << " " << p[2] << std::endl;
     }
+    infile.close();
+    printf(" Done! Wrote %'ld critical points\n", cp.size());
+}
+
+// -----------------------------------------------------------------------
+// regions of interest of regular grids
+
+bool RW::grid_geometry(const std::vector<size_t> &dims, const std::vector<point> &points, double origin[3], double spacing[3]) {
+
+    // the spacing is measured along the first line of vertices
+    const size_t gdims[3] = {dims[0], dims[1], (dims.size() > 2) ? dims[2] : 1};
+    const size_t stride[3] = {1, gdims[0], gdims[0]*gdims[1]};
+    for(int a = 0; a < 3; a++){
+        origin[a] = points[0][a];
+        spacing[a] = (gdims[a] > 1) ? points[stride[a]][a] - points[0][a] : 1.0;
     }
 
-    qfile.close();
-    printf(" Done! Read [%dx%dx%d] = %'ld vectors\n", x, y, z, vfield.size());
-    return vfield;
+    // and every vertex must be where the spacing puts it
+    double tol = 0;
+    for(int a = 0; a < 3; a++)
+        tol = std::max(tol, 1e-6*std::fabs(spacing[a]));
+
+    size_t idx = 0;
+    for(size_t k = 0; k < gdims[2]; k++){
+    for(size_t j = 0; j < gdims[1]; j++){
+    for(size_t i = 0; i < gdims[0]; i++, idx++){
+        const size_t ijk[3] = {i, j, k};
+        for(int a = 0; a < 3; a++){
+            const double expected = origin[a] + (gdims[a] > 1 ? spacing[a]*double(ijk[a]) : 0.0);
+            if(std::fabs(points[idx][a] - expected) > tol)
+                return false;
+        }
+    }
+    }
+    }
+    return true;
 }
 
-vector<point> RW::read_plot3d_x(string filename, int &x, int &y, int &z){
+bool RW::covering_region(const Box &box, const std::vector<size_t> &dims, const double origin[3], const double spacing[3],
+                         size_t lo[3], size_t hi[3]) {
+
+    for(int a = 0; a < 3; a++){
 
-    ifstream xfile;     xfile.open(filename.c_str());
-    if(!xfile.is_open()){
+        const size_t n = (a < int(dims.size())) ? dims[a] : 1;
+        if(n == 1){
+            lo[a] = hi[a] = 0;
+            continue;
+        }
+
+        double l = box.lo[a], h = box.hi[a];
+        if(box.physical){
+            l = (l - origin[a]) / spacing[a];
+            h = (h - origin[a]) / spacing[a];
+            if(l > h)
+                std::swap(l, h);
+        }
+
+        if(l > h || h < 0 || l > double(n-1))
+            return false;
+
+        lo[a] = (l <= 0) ? 0 : size_t(std::floor(l));
+        hi[a] = (h >= double(n-1)) ? n-1 : size_t(std::ceil(h));
+
+        // at least one layer of cells
+        if(lo[a] == hi[a]){
+            if(hi[a] < n-1)     hi[a]++;
+            else                lo[a]--;
+        }
+    }
+    return true;
+}
+
+bool RW::covering_region(const Box &box, const std::vector<size_t> &dims, const std::vector<point> &points,
+                         size_t lo[3], size_t hi[3]) {
+
+    const size_t n[3] = {dims[0], dims[1], (dims.size() > 2) ? dims[2] : 1};
+    const size_t nc[3] = {std::max(n[0], size_t(2))-1, std::max(n[1], size_t(2))-1, std::max(n[2], size_t(2))-1};
+    const int dim = (n[2] > 1) ? 3 : 2;
+
+    for(int a = 0; a < 3; a++){
+        lo[a] = n[a]-1;
+        hi[a] = 0;
+    }
+
+    bool found = false;
+    for(size_t k = 0; k < nc[2]; k++){
+    for(size_t j = 0; j < nc[1]; j++){
+    for(size_t i = 0; i < nc[0]; i++){
+
+        // bounding box of the cell
+        point pmin, pmax;
+        const size_t ijk[3] = {i, j, k};
+        for(int c = 0; c < 8; c++){
+
+            size_t v[3];
+            bool valid = true;
+            for(int a = 0; a < 3; a++){
+                v[a] = ijk[a] + ((c>>a)&1);
+                valid = valid && (v[a] < n[a]);
+            }
+            if(!valid)
+                continue;
+
+            const point &p = points[(v[2]*n[1] + v[1])*n[0] + v[0]];
+            pmin = (c == 0) ? p : point(std::min(pmin[0], p[0]), std::min(pmin[1], p[1]), std::min(pmin[2], p[2]));
+            pmax = (c == 0) ? p : point(std::max(pmax[0], p[0]), std::max(pmax[1], p[1]), std::max(pmax[2], p[2]));
+        }
+
+        bool hit = true;
+        for(int a = 0; a < dim; a++)
+            hit = hit && (pmax[a] >= std::min(box.lo[a], box.hi[a])) && (pmin[a] <= std::max(box.lo[a], box.hi[a]));
+        if(!hit)
+            continue;
+
+        found = true;
+        for(int a = 0; a < 3; a++){
+            lo[a] = std::min(lo[a], ijk[a]);
+            hi[a] = std::max(hi[a], std::min(ijk[a]+1, n[a]-1));
+        }
+    }
+    }
+    }
+    return found;
+}
+
+template <typename T>
+void RW::crop(GridBlock<T> &block, const std::vector<size_t> &dims, const std::vector<Vec<3,T> > &vfield,
+              const std::vector<point> &points, const Box &box) {
+
+    // a physical box is located using the coordinates of the cells, unless the grid is uniform
+    double origin[3], spacing[3];
+    const bool uniform = grid_geometry(dims, points, origin, spacing);
+
+    size_t lo[3], hi[3];
+    const bool found = (uniform || !box.physical) ? covering_region(box, dims, origin, spacing, lo, hi)
+                                                  : covering_region(box, dims, points, lo, hi);
+    if(!found){
+        cerr << " The region of interest does not intersect the grid" << endl;
+        exit(1);
+    }
+
+    const size_t X = dims[0], Y = dims[1];
+
+    block.dims.resize(3);
+    block.offset.resize(3);
+    for(int a = 0; a < 3; a++){
+        block.dims[a] = hi[a] - lo[a] + 1;
+        block.offset[a] = lo[a];
+    }
+
+    block.vfield.clear();
+    block.points.clear();
+    for(size_t k = lo[2]; k <= hi[2]; k++){
+    for(size_t j = lo[1]; j <= hi[1]; j++){
+        const size_t first = X*Y*k + X*j + lo[0];
+        block.vfield.insert(block.vfield.end(), vfield.begin() + first, vfield.begin() + first + block.dims[0]);
+        block.points.insert(block.points.end(), points.begin() + first, points.begin() + first + block.dims[0]);
+    }
+    }
+}
+
+template <typename T>
+void RW::read_raw(GridBlock<T> &block, const std::vector<size_t> &global_dims, int vdim, const Box &box) {
+
+    ifstream infile(block.filename.c_str(), ios::binary);
+    if(!infile.is_open()){
+        cerr << "Unable to open file "<<block.filename<<endl;
+        exit(1);
+    }
+
+    const size_t X = global_dims[0], Y = global_dims[1], Z = (global_dims.size() > 2) ? global_dims[2] : 1;
+
+    infile.seekg(0, ios::end);
+    const size_t fsize = size_t(infile.tellg());
+    if(fsize != X*Y*Z*vdim*sizeof(T)){
+        cerr << " Invalid raw file " << block.filename << ": expected " << X*Y*Z*vdim*sizeof(T)
+             << " bytes for [" << X << " x " << Y << " x " << Z << "] vectors, found " << fsize << endl;
+        exit(1);
+    }
+
+    const double origin[3] = {0, 0, 0}, spacing[3] = {1, 1, 1};
+    size_t lo[3], hi[3];
+    if(!covering_region(box, global_dims, origin, spacing, lo, hi)){
+        cerr << " The region of interest does not intersect the grid" << endl;
+        exit(1);
+    }
+
+    printf(" Read raw file %s...", block.filename.c_str());
+    fflush(stdout);
+
+    block.dims.resize(3);
+    block.offset.resize(3);
+    for(int a = 0; a < 3; a++){
+        block.dims[a] = hi[a] - lo[a] + 1;
+        block.offset[a] = lo[a];
+    }
+
+    const size_t npoints = block.dims[0]*block.dims[1]*block.dims[2];
+    Numa::first_touch(block.vfield, npoints);
+    Numa::first_touch(block.points, npoints);
+
+    // only the rows of the region are read
+    std::vector<T> row (block.dims[0]*vdim);
+    size_t idx = 0;
+    for(size_t k = lo[2]; k <= hi[2]; k++){
+    for(size_t j = lo[1]; j <= hi[1]; j++){
+
+        infile.seekg((X*Y*k + X*j + lo[0])*vdim*sizeof(T));
+        infile.read(reinterpret_cast<char*>(row.data()), row.size()*sizeof(T));
+
+        for(size_t i = 0; i < block.dims[0]; i++, idx++){
+            block.points[idx] = point(double(lo[0]+i), double(j), double(k));
+            for(int d = 0; d < vdim; d++)
+                block.vfield[idx][d] = row[i*vdim+d];
+        }
+    }
+    }
+
+    if(!infile){
+        cerr << " Unable to read " << block.filename << endl;
+        exit(1);
+    }
+    infile.close();
+    printf(" Done! Read %'ld vectors, region = [%ld x %ld x %ld] at (%ld, %ld, %ld)\n", npoints,
+           block.dims[0], block.dims[1], block.dims[2], block.offset[0], block.offset[1], block.offset[2]);
+    Numa::report("vectors", block.vfield.data(), npoints*sizeof(Vec<3,T>));
+}
+
+template <typename T>
+void RW::read_raw(ScalarGrid<T> &grid, const std::string &filename, const std::vector<size_t> &dims) {
+
+    ifstream infile(filename.c_str(), ios::binary);
+    if(!infile.is_open()){
         cerr << "Unable to open file "<<filename<<endl;
         exit(1);
     }
 
-    // --------------------------------------
-    // read xfile
-    printf(" Read plot3d file %s...", filename.c_str());
+    const size_t npoints = dims[0]*dims[1]*((dims.size() > 2) ? dims[2] : 1);
+
+    infile.seekg(0, ios::end);
+    const size_t fsize = size_t(infile.tellg());
+    if(fsize != npoints*sizeof(T)){
+        cerr << " Invalid raw file " << filename << ": expected " << npoints*sizeof(T)
+             << " bytes for " << npoints << " scalars, found " << fsize << endl;
+        exit(1);
+    }
+
+    printf(" Read raw file %s...", filename.c_str());
     fflush(stdout);
 
-    string str;
-    getline(xfile, str);    x = atoi(str.c_str());
-    getline(xfile, str);    y = atoi(str.c_str());
-    getline(xfile, str);    z = atoi(str.c_str());
+    grid.dims = dims;
+    grid.values.resize(npoints);
+    infile.seekg(0);
+    infile.read(reinterpret_cast<char*>(grid.values.data()), npoints*sizeof(T));
+    if(!infile){
+        cerr << " Unable to read " << filename << endl;
+        exit(1);
+    }
+    infile.close();
+    printf(" Done! Read %'ld scalars\n", npoints);
+}
+
+// -----------------------------------------------------------------------
+// brick files
+//
+// header:  "RCPBRICK", version, ncomps, dtype, bsize (uint32),
+//          dims[3] (uint64), origin[3], spacing[3] (double), nbricks (uint64)
+// index:   for every brick, offset, csize (uint64), codec, first[3], dims[3] (uint32),
+//          vmin[3], vmax[3] (double)
+// data:    the vertices of every brick in row-major order, with ncomps
+//          interleaved components of dtype bytes each
+// all values are stored in the byte order of the machine
+// -----------------------------------------------------------------------
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+
+static const char BRICK_MAGIC[8] = {'R','C','P','B','R','I','C','K'};
+static const uint32_t BRICK_VERSION = 1;
+
+template <typename T>
+static void write_pod(ofstream &out, const T *vals, size_t n = 1) {
+    out.write(reinterpret_cast<const char*>(vals), n*sizeof(T));
+}
+
+template <typename T>
+static void read_pod(ifstream &in, T *vals, size_t n = 1) {
+    in.read(reinterpret_cast<char*>(vals), n*sizeof(T));
+}
 
-    unsigned int sz = x*y*z;
+static const size_t BRICK_HEADER_SIZE = 8 + 4*sizeof(uint32_t) + 3*sizeof(uint64_t) + 6*sizeof(double) + sizeof(uint64_t);
+static const size_t BRICK_ENTRY_SIZE = 2*sizeof(uint64_t) + 7*sizeof(uint32_t) + 6*sizeof(double);
 
-    vector<vec> points(sz);
-    for(unsigned int j = 0; j < 3; j++){
-    for(unsigned int i = 0; i < sz; i++){
-        getline(xfile, str);
-        points[i][j] = atof(str.c_str());
+static void write_entry(ofstream &out, const RW::BrickInfo &b) {
+    write_pod(out, &b.offset);      write_pod(out, &b.csize);
+    write_pod(out, &b.codec);
+    write_pod(out, b.first, 3);     write_pod(out, b.dims, 3);
+    write_pod(out, b.vmin, 3);      write_pod(out, b.vmax, 3);
+}
+
+static void read_entry(ifstream &in, RW::BrickInfo &b) {
+    read_pod(in, &b.offset);        read_pod(in, &b.csize);
+    read_pod(in, &b.codec);
+    read_pod(in, b.first, 3);       read_pod(in, b.dims, 3);
+    read_pod(in, b.vmin, 3);        read_pod(in, b.vmax, 3);
+}
+
+template <typename T>
+void RW::write_bricks(const std::string &filename, const std::vector<size_t> &dims,
+                      const std::vector<Vec<3,T> > &vfield, const std::vector<point> &points, int vdim, uint32_t bsize) {
+
+    ofstream out(filename.c_str(), ios::binary);
+    if(!out.is_open()){
+        cerr << "Unable to open file "<<filename<<endl;
+        exit(1);
     }
+
+    printf(" Write brick file %s...", filename.c_str());
+    fflush(stdout);
+
+    const uint64_t gdims[3] = {dims[0], dims[1], (dims.size() > 2) ? dims[2] : 1};
+    const size_t stride[3] = {1, gdims[0], gdims[0]*gdims[1]};
+
+    double origin[3], spacing[3];
+    grid_geometry(dims, points, origin, spacing);
+
+    // the bricks tile the cells, and share the vertices on their boundaries
+    size_t nb[3];
+    for(int a = 0; a < 3; a++){
+        const size_t ncells = (gdims[a] > 1) ? gdims[a]-1 : 0;
+        nb[a] = (ncells == 0) ? 1 : (ncells + bsize - 1) / bsize;
     }
+    const uint64_t nbricks = nb[0]*nb[1]*nb[2];
+
+    const uint32_t ncomps = uint32_t(vdim), dtype = sizeof(T);
+    out.write(BRICK_MAGIC, 8);
+    write_pod(out, &BRICK_VERSION);     write_pod(out, &ncomps);
+    write_pod(out, &dtype);             write_pod(out, &bsize);
+    write_pod(out, gdims, 3);
+    write_pod(out, origin, 3);          write_pod(out, spacing, 3);
+    write_pod(out, &nbricks);
+
+    // the index is written once the sizes of the bricks are known
+    std::vector<BrickInfo> bricks (nbricks);
+    uint64_t offset = BRICK_HEADER_SIZE + nbricks*BRICK_ENTRY_SIZE;
+    out.seekp(offset);
+
+    std::vector<T> raw;
+    size_t nbytes = 0;
+
+    for(size_t b = 0; b < nbricks; b++){
+
+        BrickInfo &brick = bricks[b];
+        const size_t bijk[3] = {b % nb[0], (b / nb[0]) % nb[1], b / (nb[0]*nb[1])};
+        for(int a = 0; a < 3; a++){
+            brick.first[a] = uint32_t(bijk[a]*bsize);
+            brick.dims[a] = uint32_t(std::min(size_t(bsize)+1, gdims[a] - brick.first[a]));
+            brick.vmin[a] = brick.vmax[a] = 0;
+        }
+        for(uint32_t d = 0; d < ncomps; d++){
+            brick.vmin[d] = std::numeric_limits<double>::max();
+            brick.vmax[d] = -std::numeric_limits<double>::max();
+        }
 
-    xfile.close();
-    printf(" Done! Read [%dx%dx%d] = %'ld points", x, y, z, points.size());
-    return points;
+        raw.clear();
+        for(uint32_t k = 0; k < brick.dims[2]; k++){
+        for(uint32_t j = 0; j < brick.dims[1]; j++){
+        for(uint32_t i = 0; i < brick.dims[0]; i++){
+
+            const Vec<3,T> &v = vfield[stride[2]*(brick.first[2]+k) + stride[1]*(brick.first[1]+j) + brick.first[0]+i];
+            for(uint32_t d = 0; d < ncomps; d++){
+                raw.push_back(v[d]);
+                brick.vmin[d] = std::min(brick.vmin[d], double(v[d]));
+                brick.vmax[d] = std::max(brick.vmax[d], double(v[d]));
+            }
+        }
+        }
+        }
+
+        const char *data = reinterpret_cast<const char*>(raw.data());
+        const size_t rsize = raw.size()*sizeof(T);
+
+        brick.codec = BRICK_RAW;
+        brick.csize = rsize;
+#ifdef USE_LZ4
+        // bricks that do not compress are stored raw
+        std::vector<char> packed (LZ4_compressBound(int(rsize)));
+        const int csize = LZ4_compress_default(data, packed.data(), int(rsize), int(packed.size()));
+        if(csize > 0 && size_t(csize) < rsize){
+            brick.codec = BRICK_LZ4;
+            brick.csize = uint64_t(csize);
+            data = packed.data();
+        }
+#endif
+        brick.offset = offset;
+        out.write(data, brick.csize);
+        offset += brick.csize;
+        nbytes += rsize;
+    }
+
+    out.seekp(BRICK_HEADER_SIZE);
+    for(size_t b = 0; b < nbricks; b++)
+        write_entry(out, bricks[b]);
+
+    out.close();
+    printf(" Done! Wrote %'ld bricks, %'ld of %'ld bytes\n", size_t(nbricks), size_t(offset), nbytes);
 }
 
-point RW::get_centroid(const ivec4 &tet, const std::vector<point> &points){
-    return ( points[tet[0]] + points[tet[1]] + points[tet[2]] + points[tet[3]] ) / 4.0;
+void RW::BrickFile::open(const std::string &filename_) {
+
+    filename = filename_;
+    ifstream in(filename.c_str(), ios::binary);
+    if(!in.is_open()){
+        cerr << "Unable to open file "<<filename<<endl;
+        exit(1);
+    }
+
+    char magic[8];
+    uint32_t version;
+    in.read(magic, 8);
+    read_pod(in, &version);
+    if(!in || !std::equal(magic, magic+8, BRICK_MAGIC) || version != BRICK_VERSION){
+        cerr << " Invalid brick file " << filename << endl;
+        exit(1);
+    }
+
+    uint64_t gdims[3], nbricks;
+    read_pod(in, &ncomps);          read_pod(in, &dtype);
+    read_pod(in, &bsize);
+    read_pod(in, gdims, 3);
+    read_pod(in, origin, 3);        read_pod(in, spacing, 3);
+    read_pod(in, &nbricks);
+
+    if((ncomps != 2 && ncomps != 3) || (dtype != sizeof(float) && dtype != sizeof(double))){
+        cerr << " Unsupported brick file " << filename << ": " << ncomps << " components of " << dtype << " bytes" << endl;
+        exit(1);
+    }
+
+    dims.assign(gdims, gdims+3);
+    bricks.resize(nbricks);
+    for(size_t b = 0; b < nbricks; b++)
+        read_entry(in, bricks[b]);
+
+    if(!in){
+        cerr << " Truncated brick file " << filename << endl;
+        exit(1);
+    }
+    in.close();
 }
 
-point RW::get_centroid(const ivec3 &tri, const std::vector<point> &points){
-    return ( points[tri[0]] + points[tri[1]] + points[tri[2]] ) / 3.0;
+bool RW::BrickFile::may_contain_zero(size_t b, double eps) const {
+
+    const BrickInfo &brick = bricks[b];
+    for(uint32_t d = 0; d < ncomps; d++){
+        if(brick.vmin[d] >= eps || brick.vmax[d] <= -eps)
+            return false;
+    }
+    return true;
 }
 
+template <typename T>
+void RW::BrickFile::read_brick(size_t b, std::vector<Vec<3,T> > &vfield, std::vector<point> &points,
+                               const size_t *lo, const size_t *hi) const {
+
+    const BrickInfo &brick = bricks[b];
+    const size_t npoints = size_t(brick.dims[0])*brick.dims[1]*brick.dims[2];
+    const size_t rsize = npoints*ncomps*dtype;
+
+    // every call uses its own stream, so bricks can be read in parallel
+    ifstream in(filename.c_str(), ios::binary);
+    std::vector<char> packed (brick.csize);
+    in.seekg(brick.offset);
+    in.read(packed.data(), brick.csize);
+    if(!in){
+        cerr << " Unable to read brick " << b << " of " << filename << endl;
+        exit(1);
+    }
+
+    std::vector<char> raw;
+    if(brick.codec == BRICK_RAW){
+        raw.swap(packed);
+    }
+    else if(brick.codec == BRICK_LZ4){
+#ifdef USE_LZ4
+        raw.resize(rsize);
+        if(LZ4_decompress_safe(packed.data(), raw.data(), int(brick.csize), int(rsize)) != int(rsize)){
+            cerr << " Corrupt brick " << b << " of " << filename << endl;
+            exit(1);
+        }
+#else
+        cerr << " LZ4 not available. Please reinstall with the LZ4 library to read " << filename << endl;
+        exit(1);
+#endif
+    }
+    else {
+        cerr << " Unknown codec " << brick.codec << " in " << filename << endl;
+        exit(1);
+    }
+
+    if(raw.size() != rsize){
+        cerr << " Corrupt brick " << b << " of " << filename << endl;
+        exit(1);
+    }
+
+    // the range of vertices to keep, in brick coordinates
+    uint32_t klo[3], khi[3];
+    size_t nkeep = 1;
+    for(int a = 0; a < 3; a++){
+        klo[a] = lo ? uint32_t(std::max(lo[a], size_t(brick.first[a])) - brick.first[a]) : 0;
+        khi[a] = hi ? uint32_t(std::min(hi[a], size_t(brick.first[a]+brick.dims[a]-1)) - brick.first[a]) : brick.dims[a]-1;
+        nkeep *= khi[a] - klo[a] + 1;
+    }
+
+    vfield.assign(nkeep, Vec<3,T>());
+    points.resize(nkeep);
+
+    const float *fvals = reinterpret_cast<const float*>(raw.data());
+    const double *dvals = reinterpret_cast<const double*>(raw.data());
+
+    size_t idx = 0;
+    for(uint32_t k = klo[2]; k <= khi[2]; k++){
+    for(uint32_t j = klo[1]; j <= khi[1]; j++){
+    for(uint32_t i = klo[0]; i <= khi[0]; i++, idx++){
+
+        const uint32_t ijk[3] = {brick.first[0]+i, brick.first[1]+j, brick.first[2]+k};
+        for(int a = 0; a < 3; a++)
+            points[idx][a] = origin[a] + spacing[a]*ijk[a];
+
+        const size_t src = (size_t(k)*brick.dims[1] + j)*brick.dims[0] + i;
+        for(uint32_t d = 0; d < ncomps; d++)
+            vfield[idx][d] = (dtype == sizeof(float)) ? T(fvals[src*ncomps+d]) : T(dvals[src*ncomps+d]);
+    }
+    }
+    }
+}
+
+// -----------------------------------------------------------------------
+// field streams
+//
+// header:  "RCPSTRM1", ncomps, dtype (uint32), dims[3] (uint64),
+//          origin[3], spacing[3] (double)
+// chunks:  n (uint64), followed by n vertices in row-major order, with ncomps
+//          interleaved components of dtype bytes each. the chunks may have any
+//          size, and continue until all vertices are sent
+// all values are sent in the byte order of the machine
+// -----------------------------------------------------------------------
+
+static const char STREAM_MAGIC[8] = {'R','C','P','S','T','R','M','1'};
+
+RW::FieldStream::~FieldStream() {
+    if(in && in != stdin)
+        fclose(in);
+}
+
+bool RW::FieldStream::read_bytes(void *data, size_t size) {
+    return fread(data, 1, size, in) == size;
+}
+
+void RW::FieldStream::open(const std::string &name_) {
+
+    name = name_;
+    in = (name == "-") ? stdin : fopen(name.c_str(), "rb");
+    if(!in){
+        cerr << "Unable to open file "<<name<<endl;
+        exit(1);
+    }
+
+    char magic[8];
+    uint64_t gdims[3];
+    if(!read_bytes(magic, 8) || !std::equal(magic, magic+8, STREAM_MAGIC) ||
+       !read_bytes(&ncomps, sizeof(ncomps)) || !read_bytes(&dtype, sizeof(dtype)) ||
+       !read_bytes(gdims, sizeof(gdims)) || !read_bytes(origin, sizeof(origin)) || !read_bytes(spacing, sizeof(spacing))){
+        cerr << " Invalid field stream " << name << endl;
+        exit(1);
+    }
+
+    if((ncomps != 2 && ncomps != 3) || (dtype != sizeof(float) && dtype != sizeof(double)) ||
+       gdims[0] < 2 || gdims[1] < 2 || (ncomps == 3 && gdims[2] < 2) || (ncomps == 2 && gdims[2] != 1)){
+        cerr << " Unsupported field stream " << name << ": " << ncomps << " components of " << dtype
+             << " bytes on [" << gdims[0] << " x " << gdims[1] << " x " << gdims[2] << "] vertices" << endl;
+        exit(1);
+    }
+    dims.assign(gdims, gdims+ncomps);
+}
+
+template <typename T>
+size_t RW::FieldStream::read(size_t n, std::vector<Vec<3,T> > &vfield, std::vector<point> &points) {
+
+    const size_t X = dims[0], Y = dims[1];
+    const size_t vsize = ncomps*dtype;
+
+    size_t count = 0;
+    while(count < n){
+
+        // a new chunk, unless the stream has ended
+        if(remaining == 0 && !read_bytes(&remaining, sizeof(remaining)))
+            break;
+
+        const size_t m = std::min(size_t(remaining), n - count);
+        buffer.resize(m*vsize);
+        if(!read_bytes(buffer.data(), buffer.size())){
+            cerr << " Truncated field stream " << name << " at vertex " << next << endl;
+            exit(1);
+        }
+
+        const float *fvals = reinterpret_cast<const float*>(buffer.data());
+        const double *dvals = reinterpret_cast<const double*>(buffer.data());
+        for(size_t i = 0; i < m; i++, next++){
+
+            const size_t ijk[3] = {next % X, (next / X) % Y, next / (X*Y)};
+            point p;
+            for(int a = 0; a < 3; a++)
+                p[a] = origin[a] + spacing[a]*ijk[a];
+            points.push_back(p);
+
+            Vec<3,T> v;
+            for(uint32_t d = 0; d < ncomps; d++)
+                v[d] = (dtype == sizeof(float)) ? T(fvals[i*ncomps+d]) : T(dvals[i*ncomps+d]);
+            vfield.push_back(v);
+        }
+        remaining -= m;
+        count += m;
+    }
+    return count;
+}
+
+// -----------------------------------------------------------------------
+// binary plot3d files
+//
+// grid file:       ngrids, dims of every grid, and then for every grid
+//                  x, y, [z], [iblank]
+// solution file:   ngrids, dims of every grid, and then for every grid
+//                  (mach, alpha, re, time) and (rho, rho*u, rho*v, [rho*w], e)
+// function file:   ngrids, (dims, nvars) of every grid, and then for every grid
+//                  the nvars variables
+// every variable is stored for all vertices of a grid before the next one.
+// single-grid files have no ngrids. with fortran record markers, ngrids, the
+// dims, and every group of values above is a record, enclosed by its size (int32)
+// -----------------------------------------------------------------------
+
+static void swap_bytes(char *data, size_t n, size_t size) {
+    for(size_t i = 0; i < n; i++)
+        std::reverse(data + i*size, data + (i+1)*size);
+}
+
+// parse the header of a plot3d file with a given layout.
+// returns the size of the header, or 0 if the file does not have this layout
+static uint64_t parse_plot3d_header(ifstream &in, uint64_t fsize, bool records, bool swap, bool multi,
+                                    int dim, bool has_nvars,
+                                    vector<vector<size_t> > &dims, vector<size_t> &nvars) {
+
+    auto read_int = [&in, fsize, swap](uint64_t pos, int64_t &val) {
+        int32_t v = 0;
+        if(pos + sizeof(v) > fsize)
+            return false;
+        in.clear();
+        in.seekg(pos);
+        in.read(reinterpret_cast<char*>(&v), sizeof(v));
+        if(swap)
+            swap_bytes(reinterpret_cast<char*>(&v), 1, sizeof(v));
+        val = v;
+        return bool(in);
+    };
+
+    const uint64_t mark = records ? 4 : 0;
+    uint64_t pos = 0;
+    int64_t ngrids = 1, m = 0;
+
+    if(multi){
+        if(records && (!read_int(pos, m) || m != 4))
+            return 0;
+        if(!read_int(pos+mark, ngrids) || ngrids < 1 || uint64_t(ngrids) > fsize/4)
+            return 0;
+        if(records && (!read_int(pos+mark+4, m) || m != 4))
+            return 0;
+        pos += 4 + 2*mark;
+    }
+
+    const int nper = has_nvars ? dim+1 : dim;
+    const int64_t rsize = ngrids*nper*4;
+    if(records && (!read_int(pos, m) || m != rsize))
+        return 0;
+    pos += mark;
+
+    dims.assign(ngrids, vector<size_t>(3, 1));
+    nvars.assign(ngrids, 0);
+    for(int64_t g = 0; g < ngrids; g++){
+    for(int i = 0; i < nper; i++, pos += 4){
+
+        int64_t val;
+        if(!read_int(pos, val) || val < 1 || uint64_t(val) > fsize)
+            return 0;
+        if(i < dim)     dims[g][i] = size_t(val);
+        else            nvars[g] = size_t(val);
+    }
+    }
+
+    if(records && (!read_int(pos, m) || m != rsize))
+        return 0;
+    return pos + mark;
+}
+
+void RW::Plot3DFile::open(const std::string &filename_, Plot3DKind kind_) {
+
+    filename = filename_;
+    kind = kind_;
+
+    ifstream in(filename.c_str(), ios::binary);
+    if(!in.is_open()){
+        cerr << "Unable to open file "<<filename<<endl;
+        exit(1);
+    }
+
+    in.seekg(0, ios::end);
+    const uint64_t fsize = uint64_t(in.tellg());
+
+    // try every layout, until the sizes of the data add up to the size of the file
+    for(int r = 1; r >= 0; r--){
+    for(int s = 0; s <= 1; s++){
+    for(int m = 1; m >= 0; m--){
+    for(int d = 3; d >= 2; d--){
+
+        const uint64_t hsize = parse_plot3d_header(in, fsize, r, s, m, d, kind == PLOT3D_FUNCTION, dims, nvars);
+        if(hsize == 0)
+            continue;
+
+        const uint64_t mark = r ? 4 : 0;
+        for(uint32_t t = 4; t <= 8; t += 4){
+        for(int b = 0; b <= (kind == PLOT3D_GRID ? 1 : 0); b++){
+
+            uint64_t pos = hsize;
+            offsets.resize(dims.size());
+            for(size_t g = 0; g < dims.size(); g++){
+
+                const uint64_t n = uint64_t(dims[g][0])*dims[g][1]*dims[g][2];
+                if(kind == PLOT3D_GRID){
+                    offsets[g] = pos + mark;
+                    pos += n*d*t + (b ? n*4 : 0) + 2*mark;
+                }
+                else if(kind == PLOT3D_SOLUTION){
+                    nvars[g] = size_t(d+2);
+                    pos += 4*t + 2*mark;
+                    offsets[g] = pos + mark + n*t;      // skip the density
+                    pos += n*nvars[g]*t + 2*mark;
+                }
+                else {
+                    offsets[g] = pos + mark;
+                    pos += n*nvars[g]*t + 2*mark;
+                }
+                if(pos > fsize)
+                    break;
+            }
+
+            if(pos == fsize){
+                records = r;
+                swap = s;
+                dim = d;
+                dtype = t;
+                iblank = b;
+                printf(" Plot3D file %s: %'ld %dD grids, %s precision%s%s\n", filename.c_str(), dims.size(), dim,
+                       (dtype == 4 ? "single" : "double"), (records ? ", fortran records" : ""),
+                       (swap ? ", swapped byte order" : ""));
+                return;
+            }
+        }
+        }
+    }
+    }
+    }
+    }
+
+    cerr << " Unrecognized plot3d file " << filename << endl;
+    exit(1);
+}
+
+// read n values of the file, starting at offset, with one read
+static vector<char> read_plot3d_values(const string &filename, uint64_t offset, size_t n, uint32_t dtype, bool swap) {
+
+    // every call uses its own stream, so grids can be read in parallel
+    ifstream in(filename.c_str(), ios::binary);
+    vector<char> data (n*dtype);
+    in.seekg(offset);
+    in.read(data.data(), data.size());
+    if(!in){
+        cerr << " Unable to read " << filename << endl;
+        exit(1);
+    }
+    if(swap)
+        swap_bytes(data.data(), n, dtype);
+    return data;
+}
+
+void RW::Plot3DFile::read_points(size_t g, std::vector<point> &points) const {
+
+    if(kind != PLOT3D_GRID){
+        cerr << " " << filename << " is not a plot3d grid file" << endl;
+        exit(1);
+    }
+
+    const size_t n = dims[g][0]*dims[g][1]*dims[g][2];
+    const vector<char> data = read_plot3d_values(filename, offsets[g], n*dim, dtype, swap);
+    const float *fvals = reinterpret_cast<const float*>(data.data());
+    const double *dvals = reinterpret_cast<const double*>(data.data());
+
+    points.assign(n, point(0,0,0));
+    for(int d = 0; d < dim; d++){
+    for(size_t i = 0; i < n; i++){
+        points[i][d] = (dtype == sizeof(float)) ? double(fvals[d*n+i]) : dvals[d*n+i];
+    }
+    }
+}
+
+template <typename T>
+void RW::Plot3DFile::read_vectors(size_t g, std::vector<Vec<3,T> > &vfield) const {
+
+    if(kind == PLOT3D_GRID){
+        cerr << " " << filename << " is not a plot3d solution or function file" << endl;
+        exit(1);
+    }
+    if(nvars[g] < size_t(dim)){
+        cerr << " Grid " << g << " of " << filename << " has " << nvars[g] << " variables, but needs " << dim << endl;
+        exit(1);
+    }
+
+    const size_t n = dims[g][0]*dims[g][1]*dims[g][2];
+    const vector<char> data = read_plot3d_values(filename, offsets[g], n*dim, dtype, swap);
+    const float *fvals = reinterpret_cast<const float*>(data.data());
+    const double *dvals = reinterpret_cast<const double*>(data.data());
+
+    vfield.assign(n, Vec<3,T>());
+    for(int d = 0; d < dim; d++){
+    for(size_t i = 0; i < n; i++){
+        vfield[i][d] = (dtype == sizeof(float)) ? T(fvals[d*n+i]) : T(dvals[d*n+i]);
+    }
+    }
+}
 
 // -----------------------------------------------------------------------
 // VTK Image file
@@ -270,60 +1367,343 @@ point RW::get_centroid(const ivec3 &tri, const std::vector<point> &points){
 #include <vtkPointData.h>
 #include <vtkImageData.h>
 #include <vtkXMLImageDataReader.h>
+#include <vtkInformation.h>
+#include <vtkStreamingDemandDrivenPipeline.h>
+
+template <typename T>
+int RW::read_vti(GridBlock<T> &block, std::vector<size_t> &global_dims, const Box &box) {
+
+    printf(" Read vti file %s...", block.filename.c_str());
+    fflush(stdout);
+
+    // read only the meta data first
+    vtkSmartPointer<vtkXMLImageDataReader> reader = vtkSmartPointer<vtkXMLImageDataReader>::New();
+    reader->SetFileName(block.filename.c_str());
+    reader->UpdateInformation();
+
+    int whole[6];
+    double origin[3], spacing[3];
+    vtkInformation *info = reader->GetOutputInformation(0);
+    info->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), whole);
+    info->Get(vtkDataObject::ORIGIN(), origin);
+    info->Get(vtkDataObject::SPACING(), spacing);
+
+    // the extent of the image need not start at 0
+    global_dims.resize(3);
+    for(int a = 0; a < 3; a++){
+        global_dims[a] = size_t(whole[2*a+1] - whole[2*a] + 1);
+        origin[a] += spacing[a]*whole[2*a];
+    }
+
+    size_t lo[3], hi[3];
+    if(!covering_region(box, global_dims, origin, spacing, lo, hi)){
+        cerr << " The region of interest does not intersect the grid" << endl;
+        exit(1);
+    }
+
+    // and then, only the pieces that cover the region
+    int extent[6];
+    block.dims.resize(3);
+    block.offset.resize(3);
+    for(int a = 0; a < 3; a++){
+        extent[2*a] = whole[2*a] + int(lo[a]);
+        extent[2*a+1] = whole[2*a] + int(hi[a]);
+        block.dims[a] = hi[a] - lo[a] + 1;
+        block.offset[a] = lo[a];
+    }
+    reader->UpdateExtent(extent);
+
+    vtkImageData* idata = reader->GetOutput();
+    vtkDataArray* field = idata->GetPointData()->GetVectors();
+
+    size_t npoints = block.dims[0]*block.dims[1]*block.dims[2];
+    Numa::first_touch(block.vfield, npoints);
+    Numa::first_touch(block.points, npoints);
+
+    for(size_t z = 0; z < block.dims[2]; z++){
+    for(size_t y = 0; y < block.dims[1]; y++){
+    for(size_t x = 0; x < block.dims[0]; x++){
+
+        size_t idx = x + y*block.dims[0] + z*block.dims[0]*block.dims[1];
+
+        // the reader may return more than the requested extent
+        int ijk[3] = {extent[0] + int(x), extent[2] + int(y), extent[4] + int(z)};
+        vtkIdType id = idata->ComputePointId(ijk);
+
+        idata->GetPoint(id, block.points[idx]);
+
+        for(uint8_t d = 0; d < 3; d++){
+            block.vfield[idx][d] = T(field->GetComponent(id, d));
+        }
+    }
+    }
+    }
+
+    printf(" Done! Read %'ld vectors, domain = [%ld x %ld x %ld]\n", block.vfield.size(), block.dims[0], block.dims[1], block.dims[2]);
+    Numa::report("vectors", block.vfield.data(), npoints*sizeof(Vec<3,T>));
+    return (global_dims[2] == 1 ? 2 : 3);
+}
 
 int RW::read_vti(std::vector<size_t> &dims, std::vector<vec> &vfield, vector<point> &points, std::string filename) {
 
+    ImageBlock block;
+    block.filename = filename;
+
+    std::vector<size_t> global_dims;
+    const int vdim = read_vti(block, global_dims, Box());
+
+    dims.swap(block.dims);
+    vfield.swap(block.vfield);
+    points.swap(block.points);
+    return vdim;
+}
+
+template <typename T>
+void RW::read_vti(ScalarGrid<T> &grid, const std::string &filename) {
+
     printf(" Read vti file %s...", filename.c_str());
     fflush(stdout);
 
-    // Read the file
     vtkSmartPointer<vtkXMLImageDataReader> reader = vtkSmartPointer<vtkXMLImageDataReader>::New();
     reader->SetFileName(filename.c_str());
     reader->Update();
 
     vtkImageData* idata = reader->GetOutput();
-    vtkDataArray* field = idata->GetPointData()->GetVectors();
+    vtkDataArray* field = idata->GetPointData()->GetScalars();
+    if (field == 0) {
+
+        // fall back to the first array with 1 component
+        for (int i = 0; i < idata->GetPointData()->GetNumberOfArrays() && field == 0; i++) {
+            vtkDataArray *arr = idata->GetPointData()->GetArray(i);
+            if (arr != 0 && arr->GetNumberOfComponents() == 1)
+                field = arr;
+        }
+    }
+    if (field == 0) {
+        std::cerr << " No scalar field found in " << filename << std::endl;
+        exit(1);
+    }
 
-    int idims[3];
-    idata->GetDimensions(idims);
+    int gdims[3];
+    idata->GetDimensions(gdims);
+    idata->GetOrigin(grid.origin);
+    idata->GetSpacing(grid.spacing);
 
-    double origin[3], spacing[3];
-    idata->GetOrigin(origin);
-    idata->GetSpacing(spacing);
+    grid.dims.resize(3);
+    for(int a = 0; a < 3; a++)
+        grid.dims[a] = size_t(gdims[a]);
 
-    dims.resize(3);
-    for(size_t i=0; i < 3; i++)
-        dims[i] = size_t(idims[i]);
+    const size_t npoints = idata->GetNumberOfPoints();
+    grid.values.resize(npoints);
+    for(size_t i = 0; i < npoints; i++)
+        grid.values[i] = T(field->GetComponent(i, 0));
 
-    size_t npoints = dims[0]*dims[1]*dims[2];
-    vfield.resize(npoints);
-    points.resize(npoints);
+    printf(" Done! Read %'ld scalars, domain = [%ld x %ld x %ld]\n", npoints, grid.dims[0], grid.dims[1], grid.dims[2]);
+}
 
-    for(size_t z = 0; z < dims[2]; z++){
-    for(size_t y = 0; y < dims[1]; y++){
-    for(size_t x = 0; x < dims[0]; x++){
+// -----------------------------------------------------------------------
+// VTK Structured grid file
 
-        size_t idx = x + y*dims[0] + z*dims[0]*dims[1];
+#include <vtkStructuredGrid.h>
+#include <vtkXMLStructuredGridReader.h>
 
-        points[idx][0] = origin[0] + float(x)*spacing[0];
-        points[idx][1] = origin[1] + float(y)*spacing[1];
-        points[idx][2] = origin[2] + float(z)*spacing[2];
+template <typename T>
+int RW::read_vts(std::vector<size_t> &dims, std::vector<Vec<3,T> > &vfield, std::vector<point> &points, std::string filename) {
 
-        for(uint8_t d = 0; d < 3; d++){
-            vfield[idx][d] = field->GetComponent(idx, d);
+    printf(" Read vts file %s...", filename.c_str());
+    fflush(stdout);
+
+    vtkSmartPointer<vtkXMLStructuredGridReader> reader = vtkSmartPointer<vtkXMLStructuredGridReader>::New();
+    reader->SetFileName(filename.c_str());
+    reader->Update();
+
+    vtkStructuredGrid* sgrid = reader->GetOutput();
+    vtkDataArray* field = sgrid->GetPointData()->GetVectors();
+    if (field == 0) {
+
+        // fall back to the first array with 2 or 3 components
+        for (int i = 0; i < sgrid->GetPointData()->GetNumberOfArrays() && field == 0; i++) {
+            vtkDataArray *arr = sgrid->GetPointData()->GetArray(i);
+            if (arr != 0 && (arr->GetNumberOfComponents() == 2 || arr->GetNumberOfComponents() == 3))
+                field = arr;
         }
     }
+    if (field == 0) {
+        std::cerr << " No vector field found in " << filename << std::endl;
+        exit(1);
     }
+
+    // the points are in the (i,j,k) order of the extent
+    int gdims[3];
+    sgrid->GetDimensions(gdims);
+    dims.resize(3);
+    for(int a = 0; a < 3; a++)
+        dims[a] = size_t(gdims[a]);
+
+    const size_t npoints = sgrid->GetNumberOfPoints();
+    const int ncomps = std::min(3, field->GetNumberOfComponents());
+
+    points.resize(npoints);
+    vfield.assign(npoints, Vec<3,T>());
+    for(size_t i = 0; i < npoints; i++){
+        sgrid->GetPoint(i, points[i]);
+        for(int d = 0; d < ncomps; d++)
+            vfield[i][d] = T(field->GetComponent(i, d));
     }
 
     printf(" Done! Read %'ld vectors, domain = [%ld x %ld x %ld]\n", vfield.size(), dims[0], dims[1], dims[2]);
     return (dims[2] == 1 ? 2 : 3);
 }
 
+// -----------------------------------------------------------------------
+// VTK Unstructured grid file
+
+#include <vtkUnstructuredGrid.h>
+#include <vtkXMLUnstructuredGridReader.h>
+#include <vtkCellType.h>
+#include <vtkIdList.h>
+
+int RW::read_vtu(std::vector<point> &points, std::vector<vec> &vfield, std::vector<ivec4> &tets, std::vector<ivec3> &tris,
+                 MixedMesh &mesh, std::string filename) {
+
+    printf(" Read vtu file %s...", filename.c_str());
+    fflush(stdout);
+
+    vtkSmartPointer<vtkXMLUnstructuredGridReader> reader = vtkSmartPointer<vtkXMLUnstructuredGridReader>::New();
+    reader->SetFileName(filename.c_str());
+    reader->Update();
+
+    vtkUnstructuredGrid* ugrid = reader->GetOutput();
+    vtkDataArray* field = ugrid->GetPointData()->GetVectors();
+    if (field == 0) {
+
+        // fall back to the first array with 2 or 3 components
+        for (int i = 0; i < ugrid->GetPointData()->GetNumberOfArrays() && field == 0; i++) {
+            vtkDataArray *arr = ugrid->GetPointData()->GetArray(i);
+            if (arr != 0 && (arr->GetNumberOfComponents() == 2 || arr->GetNumberOfComponents() == 3))
+                field = arr;
+        }
+    }
+    if (field == 0) {
+        std::cerr << " No vector field found in " << filename << std::endl;
+        exit(1);
+    }
+
+    const size_t npoints = ugrid->GetNumberOfPoints();
+    const size_t ncells = ugrid->GetNumberOfCells();
+    const int ncomps = std::min(3, field->GetNumberOfComponents());
+
+    points.resize(npoints);
+    vfield.resize(npoints);
+    for(size_t i = 0; i < npoints; i++){
+        ugrid->GetPoint(i, points[i]);
+        for(int d = 0; d < ncomps; d++)
+            vfield[i][d] = field->GetComponent(i, d);
+    }
+
+    // pixels and voxels are quads and hexahedra with a lexicographic vertex order
+    bool simplicial = true;
+    bool is2D = true;
+    for(size_t c = 0; c < ncells; c++){
+        const int type = ugrid->GetCellType(c);
+        simplicial = simplicial && (type == VTK_TETRA || type == VTK_TRIANGLE);
+        is2D = is2D && (type == VTK_TRIANGLE || type == VTK_QUAD || type == VTK_PIXEL);
+    }
+
+    tets.clear();
+    tris.clear();
+    mesh = MixedMesh();
+
+    vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+    for(size_t c = 0; c < ncells; c++){
+
+        const int type = ugrid->GetCellType(c);
+        ugrid->GetCellPoints(c, ids);
+
+        int v[8];
+        for(int i = 0; i < ids->GetNumberOfIds() && i < 8; i++)
+            v[i] = int(ids->GetId(i));
+
+        if (simplicial && type == VTK_TETRA)
+            tets.push_back(ivec4(v[0], v[1], v[2], v[3]));
+        else if (simplicial && type == VTK_TRIANGLE)
+            tris.push_back(ivec3(v[0], v[1], v[2]));
+
+        else if ((type == VTK_TETRA || type == VTK_PYRAMID || type == VTK_WEDGE || type == VTK_HEXAHEDRON) && !is2D)
+            mesh.add_cell(uint8_t(type), v, ids->GetNumberOfIds());
+        else if ((type == VTK_TRIANGLE || type == VTK_QUAD) && is2D)
+            mesh.add_cell(uint8_t(type), v, ids->GetNumberOfIds());
+
+        else if (type == VTK_VOXEL && !is2D) {
+            const int h[8] = { v[0], v[1], v[3], v[2], v[4], v[5], v[7], v[6] };
+            mesh.add_cell(CELL_HEXAHEDRON, h, 8);
+        }
+        else if (type == VTK_PIXEL && is2D) {
+            const int q[4] = { v[0], v[1], v[3], v[2] };
+            mesh.add_cell(CELL_QUAD, q, 4);
+        }
+        else {
+            std::cerr << " Unsupported cell type " << type << " in " << filename << std::endl;
+            exit(1);
+        }
+    }
+
+    if (!tets.empty() && !tris.empty()) {
+        std::cerr << " Found both tets and triangles in " << filename << std::endl;
+        exit(1);
+    }
+
+    printf(" Done! Read %'ld vectors and %'ld cells\n", vfield.size(), ncells);
+    return is2D ? 2 : 3;
+}
+
 #else
+template <typename T>
+int RW::read_vti(GridBlock<T> &block, std::vector<size_t> &global_dims, const Box &box) {
+    printf("VTK not available. Please reinstall with VTK libraries!\n");
+    exit(1);
+}
+
 int RW::read_vti(std::vector<size_t> &dims, std::vector<vec> &vfield, vector<point> &points, std::string filename) {
     printf("VTK not available. Please reinstall with VTK libraries!\n");
     exit(1);
 }
+
+template <typename T>
+void RW::read_vti(ScalarGrid<T> &grid, const std::string &filename) {
+    printf("VTK not available. Please reinstall with VTK libraries!\n");
+    exit(1);
+}
+
+template <typename T>
+int RW::read_vts(std::vector<size_t> &dims, std::vector<Vec<3,T> > &vfield, std::vector<point> &points, std::string filename) {
+    printf("VTK not available. Please reinstall with VTK libraries!\n");
+    exit(1);
+}
+
+int RW::read_vtu(std::vector<point> &points, std::vector<vec> &vfield, std::vector<ivec4> &tets, std::vector<ivec3> &tris,
+                 MixedMesh &mesh, std::string filename) {
+    printf("VTK not available. Please reinstall with VTK libraries!\n");
+    exit(1);
+}
 #endif
 // -----------------------------------------------------------------------
+// the readers of regular grids for vector fields of floats and doubles
+
+#define RW_INSTANTIATE(T) \
+    template void RW::read_text(std::vector<point>&, std::vector<Vec<3,T> >&, std::string, int); \
+    template size_t RW::read_text(std::istream&, std::vector<point>&, std::vector<Vec<3,T> >&, int, size_t); \
+    template void RW::read_blocks_info(std::vector<GridBlock<T> >&, std::vector<size_t>&, const std::string&); \
+    template void RW::crop(GridBlock<T>&, const std::vector<size_t>&, const std::vector<Vec<3,T> >&, const std::vector<point>&, const Box&); \
+    template int RW::read_vti(GridBlock<T>&, std::vector<size_t>&, const Box&); \
+    template int RW::read_vts(std::vector<size_t>&, std::vector<Vec<3,T> >&, std::vector<point>&, std::string); \
+    template void RW::read_raw(GridBlock<T>&, const std::vector<size_t>&, int, const Box&); \
+    template void RW::read_raw(ScalarGrid<T>&, const std::string&, const std::vector<size_t>&); \
+    template void RW::read_vti(ScalarGrid<T>&, const std::string&); \
+    template void RW::BrickFile::read_brick(size_t, std::vector<Vec<3,T> >&, std::vector<point>&, const size_t*, const size_t*) const; \
+    template void RW::write_bricks(const std::string&, const std::vector<size_t>&, const std::vector<Vec<3,T> >&, const std::vector<point>&, int, uint32_t); \
+    template void RW::Plot3DFile::read_vectors(size_t, std::vector<Vec<3,T> >&) const; \
+    template size_t RW::FieldStream::read(size_t, std::vector<Vec<3,T> >&, std::vector<point>&);
+
+RW_INSTANTIATE(float)
+RW_INSTANTIATE(double)
@@ -0,0 +1,130 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+#include <cstdlib>
+#include "SFC.h"
+
+static const int SFC_BITS = 21;
+
+// -----------------------------------------------------------------------
+SFC::Curve SFC::parse_curve(const std::string &name) {
+
+    if (name == "morton")   return MORTON;
+    if (name == "hilbert")  return HILBERT;
+
+    std::cerr << " Invalid curve " << name << ". Can be morton or hilbert!\n";
+    exit(1);
+}
+
+// spread the lower 21 bits of x to every third bit
+static uint64_t spread3(uint64_t x) {
+
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffff;
+    x = (x | x << 16) & 0x1f0000ff0000ff;
+    x = (x | x << 8)  & 0x100f00f00f00f00f;
+    x = (x | x << 4)  & 0x10c30c30c30c30c3;
+    x = (x | x << 2)  & 0x1249249249249249;
+    return x;
+}
+
+static uint64_t morton(uint32_t *X) {
+    return spread3(X[0]) | (spread3(X[1]) << 1) | (spread3(X[2]) << 2);
+}
+
+// J. Skilling, Programming the Hilbert curve, AIP Conf. Proc. 707, 2004
+static uint64_t hilbert(uint32_t *X) {
+
+    const int n = 3;
+    const uint32_t M = 1u << (SFC_BITS-1);
+
+    // inverse undo
+    for(uint32_t Q = M; Q > 1; Q >>= 1){
+        const uint32_t P = Q-1;
+        for(int i = 0; i < n; i++){
+            if(X[i] & Q)
+                X[0] ^= P;
+            else {
+                const uint32_t t = (X[0] ^ X[i]) & P;
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+
+    // gray encode
+    for(int i = 1; i < n; i++)
+        X[i] ^= X[i-1];
+
+    uint32_t t = 0;
+    for(uint32_t Q = M; Q > 1; Q >>= 1){
+        if(X[n-1] & Q)
+            t ^= Q-1;
+    }
+    for(int i = 0; i < n; i++)
+        X[i] ^= t;
+
+    // interleave the transposed index
+    uint64_t h = 0;
+    for(int b = SFC_BITS-1; b >= 0; b--){
+    for(int i = 0; i < n; i++){
+        h = (h << 1) | ((X[i] >> b) & 1);
+    }
+    }
+    return h;
+}
+
+std::vector<uint64_t> SFC::codes(const std::vector<point> &points, Curve curve) {
+
+    const size_t npoints = points.size();
+    std::vector<uint64_t> codes (npoints, 0);
+    if (npoints == 0 || curve == NONE)
+        return codes;
+
+    point lo = points[0], hi = points[0];
+    for(size_t i = 1; i < npoints; i++){
+    for(int d = 0; d < 3; d++){
+        lo[d] = std::min(lo[d], points[i][d]);
+        hi[d] = std::max(hi[d], points[i][d]);
+    }
+    }
+
+    const double maxq = double((1u << SFC_BITS) - 1);
+    point scale;
+    for(int d = 0; d < 3; d++)
+        scale[d] = (hi[d] > lo[d]) ? maxq / (hi[d] - lo[d]) : 0.0;
+
+    #pragma omp parallel for
+    for(size_t i = 0; i < npoints; i++){
+
+        uint32_t X[3];
+        for(int d = 0; d < 3; d++)
+            X[d] = uint32_t((points[i][d] - lo[d]) * scale[d]);
+
+        codes[i] = (curve == HILBERT) ? hilbert(X) : morton(X);
+    }
+    return codes;
+}
+
+std::vector<size_t> SFC::sort_permutation(const std::vector<uint64_t> &codes) {
+
+    std::vector<size_t> perm (codes.size());
+    for(size_t i = 0; i < perm.size(); i++)
+        perm[i] = i;
+
+    // ties are broken by the original position, so the permutation is deterministic
+    Parallel::sort(perm.begin(), perm.end(), [&codes](size_t a, size_t b) {
+        return (codes[a] != codes[b]) ? (codes[a] < codes[b]) : (a < b);
+    });
+    return perm;
+}
@@ -0,0 +1,226 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <climits>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "parallel.h"
+
+using namespace std;
+
+// -----------------------------------------------------------------------
+// hashing: two 64-bit lanes of multiply-rotate rounds (as in MurmurHash3)
+
+struct H128 {   uint64_t a, b;  };
+
+static inline uint64_t rotl(uint64_t x, int r) {   return (x << r) | (x >> (64 - r));   }
+
+static inline uint64_t fmix(uint64_t k) {
+    k ^= k >> 33;   k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;   k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static inline void mix(H128 &h, uint64_t x, uint64_t y) {
+    h.a = rotl(h.a ^ (x * 0x87c37b91114253d5ULL), 31) * 0x4cf5ad432745937fULL;
+    h.b = rotl(h.b ^ (y * 0x4cf5ad432745937fULL), 33) * 0x87c37b91114253d5ULL;
+    h.a += h.b;     h.b += h.a;
+}
+
+static H128 hash_bytes(const char *data, size_t n, uint64_t seed) {
+
+    H128 h = { seed ^ 0x9e3779b97f4a7c15ULL, seed ^ 0xc2b2ae3d27d4eb4fULL };
+
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        uint64_t x, y;
+        memcpy(&x, data + i, 8);
+        memcpy(&y, data + i + 8, 8);
+        mix(h, x, y);
+    }
+    if(i < n){
+        char tail[16] = {0};
+        memcpy(tail, data + i, n - i);
+        uint64_t x, y;
+        memcpy(&x, tail, 8);
+        memcpy(&y, tail + 8, 8);
+        mix(h, x, y);
+    }
+
+    h.a ^= n;               h.b ^= n;
+    h.a += h.b;             h.b += h.a;
+    h.a = fmix(h.a);        h.b = fmix(h.b);
+    h.a += h.b;             h.b += h.a;
+    return h;
+}
+
+static std::string to_hex(const H128 &h) {
+    char hex[33];
+    snprintf(hex, sizeof(hex), "%016llx%016llx", (unsigned long long) h.a, (unsigned long long) h.b);
+    return std::string(hex);
+}
+
+std::string Hash::string(const std::string &data) {
+    return to_hex(hash_bytes(data.data(), data.size(), 0));
+}
+
+std::string Hash::file(const std::string &filename) {
+
+    static const size_t BLOCK = size_t(1) << 22;
+
+    ifstream infile(filename.c_str(), ios::binary);
+    if(!infile.is_open()){
+        cerr << "Unable to open file "<<filename<<endl;
+        exit(1);
+    }
+
+    // the hashes of the blocks (seeded by their index) are hashed again at the end
+    const size_t nthreads = size_t(Parallel::num_threads());
+    vector<vector<char> > buffers (nthreads, vector<char>(BLOCK));
+    vector<size_t> sizes (nthreads);
+    vector<H128> hashes (nthreads);
+
+    std::string digests;
+    uint64_t nblocks = 0, nbytes = 0;
+
+    while(infile){
+
+        // read the next batch of blocks
+        size_t nread = 0;
+        for(; nread < nthreads && infile; nread++){
+            infile.read(buffers[nread].data(), BLOCK);
+            sizes[nread] = size_t(infile.gcount());
+            if(sizes[nread] == 0)
+                break;
+        }
+
+        #pragma omp parallel for
+        for(size_t i = 0; i < nread; i++){
+            hashes[i] = hash_bytes(buffers[i].data(), sizes[i], nblocks + i);
+        }
+
+        for(size_t i = 0; i < nread; i++){
+            digests.append(reinterpret_cast<const char*>(&hashes[i]), sizeof(H128));
+            nbytes += sizes[i];
+        }
+        nblocks += nread;
+    }
+
+    return to_hex(hash_bytes(digests.data(), digests.size(), nbytes));
+}
+
+// -----------------------------------------------------------------------
+// result cache
+
+ResultCache::ResultCache(const std::string &dir_) : dir(dir_) {
+
+    if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST){
+        cerr << " Unable to create cache directory " << dir << ": " << strerror(errno) << endl;
+        exit(1);
+    }
+
+    // each line is: size mtime hash path. the index is only ever appended to,
+    // so the last line of a path is the valid one
+    ifstream infile(index_file().c_str());
+    std::string line;
+    while(getline(infile, line)){
+
+        istringstream iss(line);
+        Entry e;
+        std::string path;
+        if(!(iss >> e.size >> e.mtime >> e.hash) || !getline(iss >> ws, path))
+            continue;
+        index[path] = e;
+    }
+}
+
+std::string ResultCache::file_hash(const std::string &filename) {
+
+    char path[PATH_MAX];
+    struct stat st;
+    if(!realpath(filename.c_str(), path) || stat(path, &st) != 0){
+        cerr << "Unable to open file "<<filename<<endl;
+        exit(1);
+    }
+
+    Entry e;
+    e.size = uint64_t(st.st_size);
+    e.mtime = int64_t(st.st_mtim.tv_sec)*1000000000 + st.st_mtim.tv_nsec;
+
+    map<std::string, Entry>::const_iterator it = index.find(path);
+    if(it != index.end() && it->second.size == e.size && it->second.mtime == e.mtime)
+        return it->second.hash;
+
+    printf(" Hashing %s...", filename.c_str());
+    fflush(stdout);
+
+    e.hash = Hash::file(filename);
+    index[path] = e;
+
+    ofstream outfile(index_file().c_str(), ios::app);
+    outfile << e.size << " " << e.mtime << " " << e.hash << " " << path << endl;
+
+    printf(" Done! %s\n", e.hash.c_str());
+    return e.hash;
+}
+
+std::string ResultCache::key(const std::vector<std::string> &parts) {
+
+    ostringstream oss;
+    oss << "v" << VERSION;
+    for(size_t i = 0; i < parts.size(); i++)
+        oss << '\n' << parts[i];
+    return Hash::string(oss.str());
+}
+
+bool ResultCache::fetch(const std::string &key, const std::string &outfilename) const {
+
+    ifstream infile(result_file(key).c_str(), ios::binary);
+    if(!infile.is_open())
+        return false;
+
+    ofstream outfile(outfilename.c_str(), ios::binary);
+    if(!outfile.is_open()){
+        cerr << "Unable to open file "<<outfilename<<endl;
+        exit(1);
+    }
+    outfile << infile.rdbuf();
+    return true;
+}
+
+void ResultCache::store(const std::string &key, const std::string &outfilename) const {
+
+    // written under a temporary name first, so that concurrent runs never see a partial result
+    const std::string target = result_file(key);
+    const std::string tmp = target + ".tmp" + to_string(getpid());
+    {
+        ifstream infile(outfilename.c_str(), ios::binary);
+        ofstream outfile(tmp.c_str(), ios::binary);
+        if(!infile.is_open() || !outfile.is_open())
+            return;
+        outfile << infile.rdbuf();
+    }
+    if(rename(tmp.c_str(), target.c_str()) != 0)
+        remove(tmp.c_str());
+}
@@ -11,161 +11,1094 @@
  For more details on the Licence, please read LICENCE file.
 */
 
+#include <unistd.h>
 #include "vec.h"
 #include "RW.h"
 #include "CP.h"
+#include "parallel.h"
+#include "SFC.h"
+#include "pipeline.h"
+#include "ensemble.h"
+#include "tracking.h"
+#include "options.h"
+#include "server.h"
+#include "cache.h"
+#include "validate.h"
+#include "numa.h"
 
 // -----------------------------------------------------------------------
-// create tets. 5 tets per cube : http://www.ics.uci.edu/~eppstein/projects/tetra/
-void create_tets(size_t X, size_t Y, size_t Z, vector<ivec4> &tets){
+// the options that change how a result is computed, but not the result.
+// they are not part of the key of a run in the result cache
+static bool result_neutral(const std::string &arg) {
 
-    printf(" Creating tets...");
+    static const char *names[] = { "result-cache", "tile", "pipeline", "brick", "numa", "huge-pages" };
 
-    size_t XY = X*Y;
-    for(size_t slice = 1; slice < Z; slice++){
-    for(size_t row = 1; row < Y; row++){
-    for(size_t col = 1; col < X; col++){
+    const size_t eq = arg.find('=');
+    const std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq-2);
+    for(size_t i = 0; i < sizeof(names)/sizeof(names[0]); i++){
+        if (name == names[i])
+            return true;
+    }
+    return false;
+}
 
-        // v is the bottom left vertex (origin)
-        // vx is the next vertex in x direction
-        // vxy is diagonally opp to v in xy plane
-        // vxyz is diag opp to v in the cube
-        int v    = XY*(slice-1) + X*(row-1) + (col-1);
+// options are removed from argv before dispatching
+void parse_options(int &argc, char *argv[], Options &opts) {
 
-        int vx   = XY*(slice-1) + X*(row-1) + (col);
-        int vy   = XY*(slice-1) + X*(row)   + (col-1);
-        int vz   = XY*(slice)   + X*(row-1) + (col-1);
+    int nargs = 0;
+    for(int i = 0; i < argc; i++){
 
-        int vxy  = XY*(slice-1) + X*(row)   + (col);
-        int vyz  = XY*(slice)   + X*(row)   + (col-1);
-        int vxz  = XY*(slice)   + X*(row-1) + (col);
+        const std::string arg (argv[i]);
+        if (arg.compare(0, 2, "--") != 0) {
+            argv[nargs++] = argv[i];
+            continue;
+        }
 
-        int vxyz = XY*(slice)   + X*(row)   + (col);
+        const std::string error = parse_option(arg, opts);
+        if (!error.empty()) {
+            std::cerr << error << std::endl;
+            exit(1);
+        }
+        if (!result_neutral(arg))
+            opts.given.push_back(arg);
+    }
+    argc = nargs;
 
-        /*cout<<" slice = "<<slice<<", col = "<<col<<" row = "<<row<<endl;
-        cout<<"\t v - "<<v<<","<<vx<<","<<vy<<","<<vz<<","<<vxy<<","<<vxz<<","<<vyz<<","<<vxyz<<endl;
+    if (opts.validate > 0 && argc > 1) {
+        std::cerr << " --validate generates its own fields, and cannot be given input files\n";
+        exit(1);
+    }
 
-        cout<<"\t creating "<<v<<","<<vx<<","<<vy<<","<<vz<<"\n";
-        cout<<"\t creating "<<vxz<<","<<vxyz<<","<<vz<<","<<vx<<"\n";
-        cout<<"\t creating "<<vyz<<","<<vz<<","<<vy<<","<<vxyz<<"\n";
-        cout<<"\t creating "<<vxy<<","<<vxyz<<","<<vx<<","<<vy<<"\n";
-        cout<<"\t creating "<<vz<<","<<vx<<","<<vxyz<<","<<vy<<"\n";*/
+    if (opts.gradient && (opts.roi || opts.pipeline > 0 || !opts.bricks.empty())) {
+        std::cerr << " --gradient cannot be combined with a region of interest, --pipeline, or --write-bricks\n";
+        exit(1);
+    }
 
-        tets.push_back( ivec4(v, vx, vz, vy) );
-        tets.push_back( ivec4(vxz, vxyz, vz, vx) );
-        tets.push_back( ivec4(vyz, vz, vy, vxyz) );
-        tets.push_back( ivec4(vxy, vxyz, vx, vy) );
-        tets.push_back( ivec4(vz, vx, vxyz, vy) );
+    if (opts.ensemble && (opts.gradient || opts.roi || opts.pipeline > 0 || !opts.bricks.empty())) {
+        std::cerr << " --ensemble cannot be combined with --gradient, a region of interest, --pipeline, or --write-bricks\n";
+        exit(1);
     }
+
+    if (opts.track && (opts.gradient || opts.ensemble || opts.roi || opts.pipeline > 0 || !opts.bricks.empty() || opts.stream)) {
+        std::cerr << " --track cannot be combined with --gradient, --ensemble, a region of interest, --pipeline, --write-bricks, or --stream\n";
+        exit(1);
     }
+
+    if (opts.stream && (opts.gradient || opts.ensemble || opts.roi || !opts.bricks.empty())) {
+        std::cerr << " --stream cannot be combined with --gradient, --ensemble, a region of interest, or --write-bricks\n";
+        exit(1);
     }
-    printf("Done! Created %'d tets!\n", tets.size());
-}
 
-// create tris. 2 triangles per quad
-void create_tris(size_t X, size_t Y, vector<ivec3> &triangles){
+    if (!opts.targets.empty() && (opts.gradient || opts.ensemble || opts.track || opts.stream || opts.roi ||
+                                  opts.pipeline > 0 || !opts.bricks.empty())) {
+        std::cerr << " --targets cannot be combined with --gradient, --ensemble, --track, --stream, a region of interest,"
+                     " --pipeline, or --write-bricks\n";
+        exit(1);
+    }
 
-    printf(" Creating triangles...");
+    if (opts.roi && (opts.pipeline > 0 || !opts.bricks.empty() ||
+                     opts.periodic[0] || opts.periodic[1] || opts.periodic[2])) {
+        std::cerr << " A region of interest cannot be combined with --pipeline, --write-bricks, or --periodic\n";
+        exit(1);
+    }
+}
 
-    for(size_t row = 1; row < Y; row++){
-    for(size_t col = 1; col < X; col++){
+// -----------------------------------------------------------------------
+// the output for the k-th target: file.cp.txt becomes file.target<k>.cp.txt
+std::string target_filename(const std::string &outfname, size_t k) {
+
+    const std::string suffix (".cp.txt");
+    const bool has_suffix = outfname.size() >= suffix.size() &&
+                            outfname.compare(outfname.size()-suffix.size(), suffix.size(), suffix) == 0;
+    const std::string stem = has_suffix ? outfname.substr(0, outfname.size()-suffix.size()) : outfname;
+    return stem + ".target" + std::to_string(k) + suffix;
+}
 
-        // v is the bottom left vertex (origin)
-        // vx is the next vertex in x direction
-        // vxy is diagonally opp to v in xy plane
-        int v    = X*(row-1) + (col-1);
+// -----------------------------------------------------------------------
+// detect critical points on a regular grid, whose simplices are never stored.
+// T is the scalar type of the vector field (float or double). with --targets,
+// detect where the field equals each target, and write one file per target
+template <typename Stencil, typename T>
+void compute_cp(const std::vector<size_t> &dims,
+                const vector<Vec<3,T> > &vfield, const vector<point> &points,
+                const std::string &outfname, const Options &opts) {
+
+    StructuredGrid<Stencil> grid(dims, opts.periodic);
+    printf(" Subdividing %'ld cells into %'ld simplices\n", grid.num_cells(), grid.num_simplices());
+
+    std::vector<point> targets;
+    if (!opts.targets.empty()) {
+        RW::read_targets(targets, opts.targets, Stencil::dim);
+        printf(" Detecting where the field equals any of %ld targets\n", targets.size());
+    }
+    const size_t nout = std::max(size_t(1), targets.size());
 
-        int vx   = X*(row-1) + (col);
-        int vy   = X*(row)   + (col-1);
-        int vxy  = X*(row)   + (col);
+    if (grid.num_vertices() <= CPDetector<T>::MAX_VERTICES) {
 
-        /*
-        cout<<" col = "<<col<<" row = "<<row<<endl;
-        cout<<"\t v - "<<v<<","<<vx<<","<<vy<<","<<vxy<<endl;
+        CPDetector<T> *CPD = new CPDetector<T>(&vfield, Stencil::dim);
+        CPD->use_tiles(opts.tile);
+        CPD->set_targets(targets);
+        CPD->compute(grid);
 
-        cout<<"\t creating "<<v<<","<<vx<<","<<vxy<<"\n";
-        cout<<"\t creating "<<v<<","<<vxy<<","<<vy<<"\n";*/
+        if (targets.empty())
+            RW::write_cp(outfname, CPD->get_CP(), grid, points);
+        for (size_t k = 0; k < targets.size(); k++)
+            RW::write_cp(target_filename(outfname, k), CPD->get_CP(k), grid, points);
+        delete CPD;
+        return;
+    }
 
-        triangles.push_back( ivec3(v, vx, vxy) );
-        triangles.push_back( ivec3(v, vxy, vy) );
+    // a grid too large for one SoS matrix is detected in slabs of vertex layers
+    // along its last axis, consecutive slabs sharing one layer. the SoS indices
+    // of a slab are in the order of the global vertex ids, so the result is the
+    // same as for the whole grid. only the output ids are global (64-bit)
+    const int axis = Stencil::dim-1;
+    const size_t nlayers = grid.num_vertices(axis);
+    const size_t layer_size = grid.num_vertices() / nlayers;
+    const size_t slab_layers = CPDetector<T>::MAX_VERTICES / layer_size;
+
+    if (slab_layers < 2) {
+        std::cerr << " A layer of the grid has too many vertices for one SoS matrix. Split the data into blocks!\n";
+        exit(1);
     }
+    if (grid.is_periodic(axis)) {
+        std::cerr << " The grid has too many vertices for one SoS matrix, and cannot be split along its periodic last axis!\n";
+        exit(1);
+    }
+
+    std::vector<bool> speriodic (opts.periodic);
+    speriodic[axis] = false;
+
+    std::vector<std::vector<size_t> > ids (nout);
+    std::vector<std::vector<point> > centroids (nout);
+    for (size_t first = 0; first+1 < nlayers; first += slab_layers-1) {
+
+        const size_t last = std::min(first + slab_layers-1, nlayers-1);
+        printf(" Slab of vertex layers [%ld, %ld] of %ld\n", first, last, nlayers);
+
+        std::vector<size_t> sdims (dims);
+        sdims[axis] = last - first + 1;
+        std::vector<size_t> offset (3, 0);
+        offset[axis] = first;
+
+        StructuredGrid<Stencil> slab(sdims, speriodic);
+        slab.set_global_extent(offset, dims);
+
+        CPDetector<T> *CPD = new CPDetector<T>(vfield.data() + first*layer_size, sdims[axis]*layer_size, Stencil::dim);
+        CPD->use_tiles(opts.tile);
+        CPD->set_targets(targets);
+        CPD->compute(slab);
+
+        for (size_t k = 0; k < nout; k++) {
+            const std::vector<size_t> &cp = targets.empty() ? CPD->get_CP() : CPD->get_CP(k);
+            for (size_t i = 0; i < cp.size(); i++) {
+                ids[k].push_back(slab.global_id(cp[i]));
+                centroids[k].push_back(grid.centroid(ids[k].back(), points));
+            }
+        }
+        delete CPD;
     }
-    printf("Done! Created %'d triangles!\n", triangles.size());
+    if (targets.empty())
+        RW::write_cp(outfname, ids[0], centroids[0]);
+    for (size_t k = 0; k < targets.size(); k++)
+        RW::write_cp(target_filename(outfname, k), ids[k], centroids[k]);
 }
 
-// -----------------------------------------------------------------------
 // actual function that computes the critical points
+template <typename T>
 void compute_cp(const int &vdim, const std::vector<size_t> &dims,
-                const vector<vec> &vfield, const vector<point> &points,
-                const std::string &outfname) {
+                const vector<Vec<3,T> > &vfield, const vector<point> &points,
+                const std::string &outfname, const Options &opts) {
+
+    if (!opts.bricks.empty() && (2 == vdim || 3 == vdim)) {
+        RW::write_bricks(opts.bricks, dims, vfield, points, vdim, opts.brick_size);
+        return;
+    }
 
     if (2 == vdim) {
+        compute_cp<Tri2>(dims, vfield, points, outfname, opts);
+    }
 
-        vector<ivec3> tris;
-        create_tris ( dims[0], dims[1], tris );
+    else if (3 == vdim) {
+        if (opts.stencil == 6)
+            compute_cp<Tet6>(dims, vfield, points, outfname, opts);
+        else
+            compute_cp<Tet5>(dims, vfield, points, outfname, opts);
+    }
 
-        CPDetector *CPD = new CPDetector(&vfield, &tris);
-        CPD->compute();
+    else {
+        std::cerr << " Invalid dimensionality! Can be 2 or 3, but found " << vdim << std::endl;
+        exit(1);
+    }
+}
 
-        const std::vector<size_t> &cp = CPD->get_CP();
+// -----------------------------------------------------------------------
+// staged detection on a regular grid given as a text file, which is read in
+// chunks while the previous chunks are filtered, detected and written
+template <typename Stencil, typename T>
+void compute_cp_pipeline(const std::string &infilename, const std::vector<size_t> &dims,
+                         const std::string &outfname, const Options &opts) {
+
+    std::ifstream infile(infilename.c_str());
+    if (!infile.is_open()) {
+        std::cerr << "Unable to open file " << infilename << std::endl;
+        exit(1);
+    }
 
-        /*
-        // display critical points
-        for(uint i = 0; i < cp.size(); i++){
+    std::ofstream outfile(outfname.c_str());
+    if (!outfile.is_open()) {
+        std::cerr << "Unable to open file " << outfname << std::endl;
+        exit(1);
+    }
 
-            uint t = cp[i];
-            point p = RW::get_centroid(tris[t], points);
-            printf(" CP exists in simplex %d at [%f, %f, %f]\n", t, p[0], p[1], p[2]);
-            //printf(" CP exists in simplex %d\n", t);
-        }*/
+    printf(" Detecting %dD Critical Points in %s, writing to %s...\n", Stencil::dim, infilename.c_str(), outfname.c_str());
+    fflush(stdout);
 
-        RW::write_cp(outfname, cp, tris, points);
-        delete CPD;
+    Pipeline::Source<T> read = [&infile](size_t n, std::vector<Vec<3,T> > &vfield, std::vector<point> &points) {
+        return RW::read_text(infile, points, vfield, Stencil::dim, n);
+    };
+
+    Pipeline::Sink<T> write = [&outfile](const Pipeline::Chunk<T> &chunk) {
+        for (size_t i = 0; i < chunk.ids.size(); i++) {
+            const point &p = chunk.centroids[i];
+            outfile << chunk.ids[i] << " " << p[0] << " " << p[1] << " " << p[2] << std::endl;
+        }
+    };
+
+    const size_t ncps = Pipeline::run<Stencil, T>(read, write, dims, opts.periodic, opts.pipeline, Parallel::num_threads());
+
+    infile.close();
+    outfile.close();
+    printf(" Done! Wrote %'ld critical points\n", ncps);
+}
+
+// -----------------------------------------------------------------------
+// staged detection on a field stream, as it arrives. the critical points of
+// every chunk are written to out as soon as the chunk is done
+template <typename Stencil, typename T>
+size_t compute_cp_stream(RW::FieldStream &stream, FILE *out, const Options &opts) {
+
+    Pipeline::Source<T> read = [&stream](size_t n, std::vector<Vec<3,T> > &vfield, std::vector<point> &points) {
+        return stream.read(n, vfield, points);
+    };
+
+    Pipeline::Sink<T> write = [out](const Pipeline::Chunk<T> &chunk) {
+        for (size_t i = 0; i < chunk.ids.size(); i++) {
+            const point &p = chunk.centroids[i];
+            fprintf(out, "%ld %g %g %g\n", chunk.ids[i], p[0], p[1], p[2]);
+        }
+        fflush(out);
+    };
+
+    const size_t layers = (opts.pipeline > 0) ? opts.pipeline : 16;
+    return Pipeline::run<Stencil, T>(read, write, stream.dims, opts.periodic, layers, Parallel::num_threads());
+}
+
+// stdout carries only the critical points, so the progress messages go to stderr
+void compute_cp_stream(const std::string &name, const Options &opts) {
+
+    fflush(stdout);
+    FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!out || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        std::cerr << " Unable to separate the critical points from the messages on stdout\n";
+        exit(1);
     }
 
-    else if (3 == vdim) {
+    RW::FieldStream stream;
+    stream.open(name);
+
+    printf(" Detecting %dD Critical Points in stream %s of [%ld x %ld x %ld] vertices (%d bytes per component)\n",
+           int(stream.ncomps), name.c_str(), stream.dims[0], stream.dims[1], (stream.ncomps == 3) ? stream.dims[2] : 1,
+           int(stream.dtype));
+    fflush(stdout);
+
+    size_t ncps;
+    const bool single = (stream.dtype == sizeof(float));
+    if (stream.ncomps == 2)
+        ncps = single ? compute_cp_stream<Tri2, float>(stream, out, opts) : compute_cp_stream<Tri2, double>(stream, out, opts);
+    else if (opts.stencil == 6)
+        ncps = single ? compute_cp_stream<Tet6, float>(stream, out, opts) : compute_cp_stream<Tet6, double>(stream, out, opts);
+    else
+        ncps = single ? compute_cp_stream<Tet5, float>(stream, out, opts) : compute_cp_stream<Tet5, double>(stream, out, opts);
+
+    fclose(out);
+    printf(" Done! Wrote %'ld critical points\n", ncps);
+}
 
-        vector<ivec4> tets;
-        create_tets ( dims[0], dims[1], dims[2], tets );
+// -----------------------------------------------------------------------
+// detect critical points in an unstructured mesh (T = ivec3 or ivec4).
+// the mesh may be reordered along a space-filling curve for locality, but the
+// simplex ids are reported in the input numbering
+template <typename T>
+void compute_cp(vector<point> &points, vector<vec> &vfield, vector<T> &cells,
+                const std::string &outfname, const Options &opts) {
+
+    std::vector<size_t> perm;
+    if (opts.reorder != SFC::NONE) {
+
+        printf(" Reordering mesh along a space-filling curve...");
+        fflush(stdout);
+
+        if (opts.reorder_vertices)
+            SFC::reorder_vertices(points, vfield, cells, opts.reorder);
+        perm = SFC::reorder_cells(cells, points, opts.reorder);
+        printf(" Done!\n");
+    }
 
-        CPDetector *CPD = new CPDetector(&vfield, &tets);
-        CPD->compute();
+    Numa::place(vfield, "vectors");
+    Numa::place(cells, "cells");
 
-        const std::vector<size_t> &cp = CPD->get_CP();
+    CPDetector<double> *CPD = new CPDetector<double>(&vfield, &cells);
+    CPD->compute();
+
+    const std::vector<size_t> &cp = CPD->get_CP();
+
+    if (perm.empty()) {
+        RW::write_cp(outfname, cp, cells, points);
+    }
+    else {
+
+        std::vector<std::pair<size_t, point> > cps (cp.size());
+        for(size_t i = 0; i < cp.size(); i++)
+            cps[i] = std::make_pair(perm[cp[i]], RW::get_centroid(cells[cp[i]], points));
+        std::sort(cps.begin(), cps.end(), [](const std::pair<size_t, point> &a, const std::pair<size_t, point> &b) {
+            return a.first < b.first;
+        });
+
+        std::vector<size_t> ids (cps.size());
+        std::vector<point> centroids (cps.size());
+        for(size_t i = 0; i < cps.size(); i++){
+            ids[i] = cps[i].first;
+            centroids[i] = cps[i].second;
+        }
+        RW::write_cp(outfname, ids, centroids);
+    }
+    delete CPD;
+}
+
+// -----------------------------------------------------------------------
+// detect critical points in the blocks of a .pvti or .vtm file, or in the
+// bricks of a brick file. load(b) fills the data of the b-th block.
+// the blocks are read in parallel, one wave of blocks per thread at a time, and
+// detected one after the other (the SoS library is not thread-safe).
+// the SoS indices of a block are the row-major indices of its vertices, which
+// are in the same order as their global indices. hence, the shared boundary
+// vertices are perturbed consistently, and the result is the same as for the
+// stitched grid.
+template <typename Stencil, typename T, typename Loader>
+void compute_cp_blocks(std::vector<RW::GridBlock<T> > &blocks, const std::vector<size_t> &global_dims,
+                       Loader load, const std::string &outfname, const Options &opts) {
+
+    std::vector<size_t> ids;
+    std::vector<point> centroids;
+
+    // simplices of unaligned blocks (e.g., amr levels) are numbered consecutively
+    size_t nprev = 0;
+
+    const size_t nblocks = blocks.size();
+    const size_t wave = size_t(Parallel::num_threads());
+
+    for(size_t w = 0; w < nblocks; w += wave){
+
+        const size_t wend = std::min(nblocks, w + wave);
+
+        #pragma omp parallel for schedule(dynamic)
+        for(size_t b = w; b < wend; b++){
+            load(b);
+        }
+
+        for(size_t b = w; b < wend; b++){
+
+            RW::GridBlock<T> &block = blocks[b];
+
+            StructuredGrid<Stencil> grid(block.dims);
+            if(!global_dims.empty())
+                grid.set_global_extent(block.offset, global_dims);
+
+            CPDetector<T> *CPD = new CPDetector<T>(&block.vfield, Stencil::dim);
+            CPD->use_tiles(opts.tile);
+            CPD->compute(grid);
+
+            const std::vector<size_t> &cp = CPD->get_CP();
+            for(size_t i = 0; i < cp.size(); i++){
+                ids.push_back(global_dims.empty() ? nprev + cp[i] : grid.global_id(cp[i]));
+                centroids.push_back(grid.centroid(cp[i], block.points));
+            }
+            delete CPD;
+
+            nprev += grid.num_simplices();
+
+            std::vector<Vec<3,T> >().swap(block.vfield);
+            std::vector<point>().swap(block.points);
+        }
+    }
+
+    // merge the blocks in the order of the global ids
+    std::vector<size_t> order (ids.size());
+    for(size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&ids](size_t a, size_t b) { return ids[a] < ids[b]; });
+
+    std::vector<size_t> sids (ids.size());
+    std::vector<point> scentroids (ids.size());
+    for(size_t i = 0; i < order.size(); i++){
+        sids[i] = ids[order[i]];
+        scentroids[i] = centroids[order[i]];
+    }
+    RW::write_cp(outfname, sids, scentroids);
+}
+
+template <typename T>
+void compute_cp_blocks(const std::string &infilename, const std::string &outfname, const Options &opts) {
+
+    std::vector<RW::GridBlock<T> > blocks;
+    std::vector<size_t> global_dims;
+    RW::read_blocks_info(blocks, global_dims, infilename);
+
+    // the offsets of the blocks come from the parent file
+    auto load = [&blocks](size_t b) {
+        const std::vector<size_t> offset (blocks[b].offset);
+        std::vector<size_t> dims;
+        RW::read_vti(blocks[b], dims, RW::Box());
+        blocks[b].offset = offset;
+    };
+
+    const bool is2D = global_dims.empty() ? (blocks[0].dims[2] == 1) : (global_dims[2] == 1);
+
+    if (is2D)
+        compute_cp_blocks<Tri2>(blocks, global_dims, load, outfname, opts);
+    else if (opts.stencil == 6)
+        compute_cp_blocks<Tet6>(blocks, global_dims, load, outfname, opts);
+    else
+        compute_cp_blocks<Tet5>(blocks, global_dims, load, outfname, opts);
+}
+
+// detect critical points in a brick file. the bricks whose range of values
+// excludes zero (in some component) cannot contain a critical point, and are
+// neither decompressed nor detected. with a region of interest, only the
+// parts of the bricks within the region are detected
+template <typename T>
+void compute_cp_bricks(const RW::BrickFile &bfile, const std::string &infilename,
+                       const std::string &outfname, const Options &opts) {
+
+    size_t lo[3], hi[3];
+    if (!RW::covering_region(opts.box, bfile.dims, bfile.origin, bfile.spacing, lo, hi)) {
+        std::cerr << " The region of interest does not intersect the grid\n";
+        exit(1);
+    }
+
+    std::vector<RW::GridBlock<T> > blocks;
+    std::vector<size_t> which;
+    for(size_t b = 0; b < bfile.bricks.size(); b++){
+
+        if (!bfile.may_contain_zero(b, CPDetector<T>::SOS_EPS))
+            continue;
+
+        // the part of the brick within the region must contain at least one cell
+        const RW::BrickInfo &brick = bfile.bricks[b];
+        RW::GridBlock<T> block;
+        block.filename = infilename;
+        block.dims.resize(3);
+        block.offset.resize(3);
+
+        bool empty = false;
+        for(int a = 0; a < 3; a++){
+            const size_t first = std::max(lo[a], size_t(brick.first[a]));
+            const size_t last = std::min(hi[a], size_t(brick.first[a] + brick.dims[a] - 1));
+            empty = empty || (last < first) || (last == first && bfile.dims[a] > 1);
+            block.offset[a] = first;
+            block.dims[a] = empty ? 0 : last - first + 1;
+        }
+        if (empty)
+            continue;
+
+        blocks.push_back(block);
+        which.push_back(b);
+    }
+
+    printf(" Brick file %s: [%ld x %ld x %ld], %'ld of %'ld bricks may contain critical points\n",
+           infilename.c_str(), bfile.dims[0], bfile.dims[1], bfile.dims[2], blocks.size(), bfile.bricks.size());
+
+    auto load = [&bfile, &blocks, &which, &lo, &hi](size_t b) {
+        bfile.read_brick(which[b], blocks[b].vfield, blocks[b].points, lo, hi);
+    };
+
+    if (bfile.ncomps == 2)
+        compute_cp_blocks<Tri2>(blocks, bfile.dims, load, outfname, opts);
+    else if (opts.stencil == 6)
+        compute_cp_blocks<Tet6>(blocks, bfile.dims, load, outfname, opts);
+    else
+        compute_cp_blocks<Tet5>(blocks, bfile.dims, load, outfname, opts);
+}
+
+// bricks of floats are detected in single precision
+void compute_cp_bricks(const std::string &infilename, const std::string &outfname, const Options &opts) {
+
+    RW::BrickFile bfile;
+    bfile.open(infilename);
+
+    if (bfile.dtype == sizeof(float))
+        compute_cp_bricks<float>(bfile, infilename, outfname, opts);
+    else
+        compute_cp_bricks<double>(bfile, infilename, outfname, opts);
+}
+
+// detect critical points in the grids of a plot3d solution or function file,
+// with the coordinates from a plot3d grid file. the grids are read in parallel,
+// and their simplices are numbered consecutively
+template <typename T>
+void compute_cp_plot3d(const RW::Plot3DFile &qfile, const RW::Plot3DFile &xfile,
+                       const std::string &outfname, const Options &opts) {
+
+    std::vector<RW::GridBlock<T> > blocks (qfile.num_grids());
+    for(size_t g = 0; g < blocks.size(); g++)
+        blocks[g].dims = qfile.dims[g];
+
+    auto load = [&qfile, &xfile, &blocks](size_t g) {
+        qfile.read_vectors(g, blocks[g].vfield);
+        xfile.read_points(g, blocks[g].points);
+    };
+
+    const std::vector<size_t> global_dims;
+    if (qfile.dim == 2)
+        compute_cp_blocks<Tri2>(blocks, global_dims, load, outfname, opts);
+    else if (opts.stencil == 6)
+        compute_cp_blocks<Tet6>(blocks, global_dims, load, outfname, opts);
+    else
+        compute_cp_blocks<Tet5>(blocks, global_dims, load, outfname, opts);
+}
+
+void compute_cp_plot3d(const std::string &infilename, const std::string &gridfilename,
+                       const std::string &outfname, const Options &opts) {
+
+    const std::string ext = infilename.substr(infilename.find_last_of('.')+1);
+
+    RW::Plot3DFile qfile, xfile;
+    qfile.open(infilename, (ext == "q") ? RW::PLOT3D_SOLUTION : RW::PLOT3D_FUNCTION);
+    xfile.open(gridfilename, RW::PLOT3D_GRID);
+
+    if (qfile.dim != xfile.dim || qfile.dims != xfile.dims) {
+        std::cerr << " The grids of " << infilename << " and " << gridfilename << " do not match\n";
+        exit(1);
+    }
+
+    // single-precision files are detected in single precision
+    if (qfile.dtype == sizeof(float) || opts.float32)
+        compute_cp_plot3d<float>(qfile, xfile, outfname, opts);
+    else
+        compute_cp_plot3d<double>(qfile, xfile, outfname, opts);
+}
+
+// detect critical points in the region of a regular grid that has been read
+// (or cropped) into block. the simplex ids refer to the whole grid
+template <typename T>
+void compute_cp_region(RW::GridBlock<T> &block, const std::vector<size_t> &global_dims, const int &vdim,
+                       const std::string &outfname, const Options &opts) {
+
+    printf(" Region of interest: [%ld x %ld x %ld] vertices at (%ld, %ld, %ld)\n",
+           block.dims[0], block.dims[1], block.dims[2], block.offset[0], block.offset[1], block.offset[2]);
+
+    std::vector<RW::GridBlock<T> > blocks (1);
+    std::swap(blocks[0], block);
+    auto load = [](size_t) {};
+
+    if (2 == vdim)
+        compute_cp_blocks<Tri2>(blocks, global_dims, load, outfname, opts);
+    else if (opts.stencil == 6)
+        compute_cp_blocks<Tet6>(blocks, global_dims, load, outfname, opts);
+    else
+        compute_cp_blocks<Tet5>(blocks, global_dims, load, outfname, opts);
+}
+
+// a grid read in full, with explicit (uniform or curvilinear) coordinates. the
+// simplices are generated from the dims, like for any regular grid, and the
+// coordinates only place the critical points and the region of interest
+template <typename T>
+void compute_cp_grid(const int &vdim, const std::vector<size_t> &dims, vector<Vec<3,T> > &vfield,
+                     vector<point> &points, const std::string &outfname, const Options &opts) {
+
+    if (opts.roi) {
+        RW::GridBlock<T> block;
+        RW::crop(block, dims, vfield, points, opts.box);
+        std::vector<Vec<3,T> >().swap(vfield);
+        std::vector<point>().swap(points);
+        compute_cp_region(block, dims, vdim, outfname, opts);
+    }
+    else {
+        Numa::place(vfield, "vectors");
+        compute_cp(vdim, dims, vfield, points, outfname, opts);
+    }
+}
+
+// a regular grid given as a text or raw file, with the dimensions on the command line.
+// with --float32, the values are read (and raw files are stored) in single precision
+template <typename T>
+void compute_cp_grid(const std::string &infilename, const int &vdim, const std::vector<size_t> &dims,
+                     const std::string &outfname, const Options &opts) {
+
+    const bool raw = (infilename.substr(infilename.find_last_of('.')+1) == "raw");
+
+    if (opts.pipeline > 0 && !raw) {
+        if (2 == vdim)
+            compute_cp_pipeline<Tri2, T>(infilename, dims, outfname, opts);
+        else if (opts.stencil == 6)
+            compute_cp_pipeline<Tet6, T>(infilename, dims, outfname, opts);
+        else
+            compute_cp_pipeline<Tet5, T>(infilename, dims, outfname, opts);
+        return;
+    }
+
+    RW::GridBlock<T> block;
+    block.filename = infilename;
+
+    if (raw) {
+        // only the region of interest is read
+        RW::read_raw(block, dims, vdim, opts.box);
+        if (opts.roi)
+            compute_cp_region(block, dims, vdim, outfname, opts);
+        else
+            compute_cp(vdim, block.dims, block.vfield, block.points, outfname, opts);
+        return;
+    }
+
+    vector<Vec<3,T> > vfield;
+    vector<point> points;
+    RW::read_text(points, vfield, infilename, vdim);
+    compute_cp_grid(vdim, dims, vfield, points, outfname, opts);
+}
+
+#ifdef USE_VTK
+// a vti file. with a region of interest, only the pieces of the file that cover the region are read
+template <typename T>
+void compute_cp_vti(const std::string &infilename, const std::string &outfname, const Options &opts) {
+
+    RW::GridBlock<T> block;
+    block.filename = infilename;
+    std::vector<size_t> global_dims;
+
+    int vdim = RW::read_vti(block, global_dims, opts.box);
+    if (opts.roi)
+        compute_cp_region(block, global_dims, vdim, outfname, opts);
+    else
+        compute_cp(vdim, block.dims, block.vfield, block.points, outfname, opts);
+}
+
+// a vts file (a curvilinear grid)
+template <typename T>
+void compute_cp_vts(const std::string &infilename, const std::string &outfname, const Options &opts) {
+
+    std::vector<size_t> dims;
+    vector<Vec<3,T> > vfield;
+    vector<point> points;
+
+    int vdim = RW::read_vts(dims, vfield, points, infilename);
+    compute_cp_grid(vdim, dims, vfield, points, outfname, opts);
+}
+#endif
+
+// -----------------------------------------------------------------------
+// detect critical points in the gradient of a scalar field on a regular grid.
+// the gradient is computed for one slab of vertex layers along the last axis
+// at a time, which is then detected on its own (like a grid too large for one
+// SoS matrix). only the scalars and the vectors of one slab are in memory.
+// along a periodic last axis, the whole grid is one slab
+template <typename Stencil, typename T>
+void compute_cp_gradient(const RW::ScalarGrid<T> &sgrid, const std::string &outfname, const Options &opts) {
+
+    // vertices per slab
+    static const size_t SLAB_SIZE = size_t(1) << 24;
+
+    const std::vector<size_t> &dims = sgrid.dims;
+    StructuredGrid<Stencil> grid(dims, opts.periodic);
+    printf(" Subdividing %'ld cells into %'ld simplices\n", grid.num_cells(), grid.num_simplices());
+
+    const int axis = Stencil::dim-1;
+    const size_t nlayers = grid.num_vertices(axis);
+    const size_t layer_size = grid.num_vertices() / nlayers;
+    const size_t max_layers = CPDetector<T>::MAX_VERTICES / layer_size;
+
+    const size_t slab_layers = grid.is_periodic(axis) ? nlayers :
+                               std::min(max_layers, std::max(SLAB_SIZE / layer_size, size_t(2)));
+    if (max_layers < 2 || slab_layers > max_layers) {
+        std::cerr << " The grid has too many vertices for one SoS matrix per slab. Split the data into blocks!\n";
+        exit(1);
+    }
+
+    std::vector<bool> speriodic (opts.periodic);
+    speriodic[axis] = grid.is_periodic(axis);
+
+    std::vector<size_t> ids;
+    std::vector<point> centroids;
+    std::vector<Vec<3,T> > grad;
+    std::vector<point> points;
+
+    for (size_t first = 0; ; first += slab_layers-1) {
+
+        const size_t last = std::min(first + slab_layers-1, nlayers-1);
+
+        Gradient::compute(sgrid.values, dims, sgrid.spacing, opts.periodic, opts.gradient_scheme, first, last, grad);
+
+        std::vector<size_t> sdims (dims);
+        sdims[axis] = last - first + 1;
+        std::vector<size_t> offset (3, 0);
+        offset[axis] = first;
+
+        points.resize(grad.size());
+        for (size_t v = 0; v < points.size(); v++) {
+            const size_t ijk[3] = {v % sdims[0], (v / sdims[0]) % sdims[1], v / (sdims[0]*sdims[1])};
+            for (int a = 0; a < 3; a++)
+                points[v][a] = sgrid.origin[a] + sgrid.spacing[a]*double(ijk[a] + offset[a]);
+        }
 
-        /*
-        // display critical points
-        for(size_t i = 0; i < cp.size(); i++){
+        StructuredGrid<Stencil> slab(sdims, speriodic);
+        slab.set_global_extent(offset, dims);
 
-            size_t t = cp[i];
-            point p = get_centroid(tets[t], points);
-            printf(" CP exists in simplex %d at [%f, %f, %f]\n", t, p[0], p[1], p[2]);
-        }*/
+        CPDetector<T> *CPD = new CPDetector<T>(&grad, Stencil::dim);
+        CPD->use_tiles(opts.tile);
+        CPD->compute(slab);
 
-        RW::write_cp(outfname, cp, tets, points);
+        const std::vector<size_t> &cp = CPD->get_CP();
+        for (size_t i = 0; i < cp.size(); i++) {
+            ids.push_back(slab.global_id(cp[i]));
+            centroids.push_back(slab.centroid(cp[i], points));
+        }
         delete CPD;
+
+        if (last+1 >= nlayers)
+            break;
+    }
+    RW::write_cp(outfname, ids, centroids);
+}
+
+// the scalar field is a .vti file, or a raw file with the dimensions on the command line
+template <typename T>
+void compute_cp_gradient(const std::string &infilename, const std::vector<size_t> &dims,
+                         const std::string &outfname, const Options &opts) {
+
+    RW::ScalarGrid<T> sgrid;
+    if (dims.empty())
+        RW::read_vti(sgrid, infilename);
+    else
+        RW::read_raw(sgrid, infilename, dims);
+
+    const bool is2D = (sgrid.dims.size() == 2) || (sgrid.dims[2] == 1);
+    if (is2D)
+        compute_cp_gradient<Tri2>(sgrid, outfname, opts);
+    else if (opts.stencil == 6)
+        compute_cp_gradient<Tet6>(sgrid, outfname, opts);
+    else
+        compute_cp_gradient<Tet5>(sgrid, outfname, opts);
+}
+
+// -----------------------------------------------------------------------
+// detect critical points in the members of an ensemble: regular grids with the
+// same dimensions, listed one file per line (relative to the list file). the
+// members are .vti files, or raw or text files with the dimensions on the
+// command line. the grid is traversed once for all the members that fit in one
+// SoS matrix (see ensemble.h), and the members of such a group are read in
+// parallel. the critical points of every member are written next to it, and
+// outfname gets the number of members with a critical point in every simplex
+std::vector<std::string> read_members(const std::string &listname) {
+
+    std::ifstream infile(listname.c_str());
+    if (!infile.is_open()) {
+        std::cerr << "Unable to open file " << listname << std::endl;
+        exit(1);
     }
 
+    const size_t slash = listname.find_last_of('/');
+    const std::string dir = (slash == std::string::npos) ? std::string() : listname.substr(0, slash+1);
+
+    std::vector<std::string> members;
+    std::string line;
+    while (std::getline(infile, line)) {
+
+        std::istringstream iss(line);
+        std::string name;
+        if (!(iss >> name) || name[0] == '#')
+            continue;
+        members.push_back(name[0] == '/' ? name : dir + name);
+    }
+
+    if (members.empty()) {
+        std::cerr << " No members listed in " << listname << std::endl;
+        exit(1);
+    }
+    return members;
+}
+
+template <typename T>
+void read_member(RW::GridBlock<T> &block, const std::vector<size_t> &dims, const int &vdim) {
+
+    const std::string ext = block.filename.substr(block.filename.find_last_of('.')+1);
+    if (ext == "vti") {
+        std::vector<size_t> global_dims;
+        RW::read_vti(block, global_dims, RW::Box());
+    }
+    else if (dims.empty()) {
+        std::cerr << " Member " << block.filename << " needs the dimensions of the grid\n";
+        exit(1);
+    }
+    else if (ext == "raw") {
+        RW::read_raw(block, dims, vdim, RW::Box());
+    }
     else {
-        std::cerr << " Invalid dimensionality! Can be 2 or 3, but found " << vdim << std::endl;
+        RW::read_text(block.points, block.vfield, block.filename, vdim);
+        block.dims = dims;
+    }
+}
+
+template <typename Stencil, typename T>
+void compute_cp_ensemble(const std::vector<std::string> &members, RW::GridBlock<T> &first,
+                         const int &vdim, const std::string &outfname, const Options &opts) {
+
+    const std::vector<size_t> &dims = first.dims;
+    const std::vector<point> &points = first.points;
+
+    StructuredGrid<Stencil> grid(dims, opts.periodic);
+    printf(" Subdividing %'ld cells into %'ld simplices\n", grid.num_cells(), grid.num_simplices());
+
+    const size_t nverts = grid.num_vertices();
+    const size_t nmembers = members.size();
+    const size_t group = std::min(nmembers, Ensemble::max_members<T>(nverts));
+    if (group == 0) {
+        std::cerr << " The grid has too many vertices for one SoS matrix. Detect the members one at a time!\n";
+        exit(1);
+    }
+    if (group < nmembers)
+        printf(" Detecting the ensemble in groups of %ld members\n", group);
+
+    std::vector<size_t> ids;
+    std::vector<Vec<3,T> > values;
+    std::vector<std::vector<size_t> > cps;
+
+    for (size_t m0 = 0; m0 < nmembers; m0 += group) {
+
+        const size_t N = std::min(group, nmembers - m0);
+        values.assign(nverts*N, Vec<3,T>());
+
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t m = m0; m < m0+N; m++) {
+
+            RW::GridBlock<T> block;
+            block.filename = members[m];
+            if (m > 0)
+                read_member(block, dims, vdim);
+
+            const std::vector<Vec<3,T> > &vfield = (m > 0) ? block.vfield : first.vfield;
+            if (vfield.size() != nverts) {
+                std::cerr << " Member " << members[m] << " has " << vfield.size() << " vertices, expected " << nverts << std::endl;
+                exit(1);
+            }
+            for (size_t v = 0; v < nverts; v++)
+                values[v*N + m-m0] = vfield[v];
+        }
+        if (m0 == 0)
+            std::vector<Vec<3,T> >().swap(first.vfield);
+
+        Ensemble::detect(grid, values, N, cps);
+
+        for (size_t m = 0; m < N; m++) {
+            RW::write_cp(members[m0+m] + ".cp.txt", cps[m], grid, points);
+            ids.insert(ids.end(), cps[m].begin(), cps[m].end());
+        }
+    }
+
+    // the frequency of every simplex with a critical point in some member
+    std::sort(ids.begin(), ids.end());
+
+    std::vector<size_t> sids, counts;
+    std::vector<point> centroids;
+    for (size_t i = 0; i < ids.size(); ) {
+
+        size_t j = i;
+        while (j < ids.size() && ids[j] == ids[i])
+            j++;
+
+        sids.push_back(ids[i]);
+        counts.push_back(j-i);
+        centroids.push_back(grid.centroid(ids[i], points));
+        i = j;
+    }
+    RW::write_cp_counts(outfname, sids, counts, centroids);
+}
+
+// the first member gives the grid (its dimensions and coordinates)
+template <typename T>
+void compute_cp_ensemble(const std::string &listname, int vdim, const std::vector<size_t> &dims,
+                         const std::string &outfname, const Options &opts) {
+
+    const std::vector<std::string> members = read_members(listname);
+    printf(" Ensemble of %ld members\n", members.size());
+
+    RW::GridBlock<T> first;
+    first.filename = members[0];
+    read_member(first, dims, vdim);
+
+    const bool is2D = (first.dims.size() == 2) || (first.dims[2] == 1);
+    if (is2D)
+        compute_cp_ensemble<Tri2>(members, first, 2, outfname, opts);
+    else if (opts.stencil == 6)
+        compute_cp_ensemble<Tet6>(members, first, 3, outfname, opts);
+    else
+        compute_cp_ensemble<Tet5>(members, first, 3, outfname, opts);
+}
+
+// -----------------------------------------------------------------------
+// track the critical points over the timesteps of a field on a regular grid,
+// which are read one at a time
+template <typename Stencil, typename T>
+void compute_cp_tracks(const std::vector<std::string> &steps, RW::GridBlock<T> &first,
+                       const int &vdim, const std::string &outfname, const Options &opts) {
+
+    const std::vector<size_t> &dims = first.dims;
+
+    StructuredGrid<Stencil> grid(dims, opts.periodic);
+    printf(" Subdividing %'ld cells into %'ld simplices\n", grid.num_cells(), grid.num_simplices());
+
+    const size_t nverts = grid.num_vertices();
+    if (nverts > Tracking::Tracker<Stencil, T>::max_vertices()) {
+        std::cerr << " The grid has too many vertices to track in one SoS matrix!\n";
         exit(1);
     }
+
+    Tracking::Tracker<Stencil, T> tracker(grid, first.points);
+    for (size_t t = 0; t < steps.size(); t++) {
+
+        RW::GridBlock<T> block;
+        block.filename = steps[t];
+        if (t > 0)
+            read_member(block, dims, vdim);
+
+        const std::vector<Vec<3,T> > &vfield = (t > 0) ? block.vfield : first.vfield;
+        if (vfield.size() != nverts) {
+            std::cerr << " Timestep " << steps[t] << " has " << vfield.size() << " vertices, expected " << nverts << std::endl;
+            exit(1);
+        }
+        tracker.add(vfield);
+        if (t == 0)
+            std::vector<Vec<3,T> >().swap(first.vfield);
+    }
+
+    Tracking::Tracks tracks;
+    tracker.tracks(tracks);
+    RW::write_tracks(outfname, tracks.offsets, tracks.points, tracks.times);
+}
+
+// the first timestep gives the grid (its dimensions and coordinates)
+template <typename T>
+void compute_cp_tracks(const std::string &listname, int vdim, const std::vector<size_t> &dims,
+                       const std::string &outfname, const Options &opts) {
+
+    const std::vector<std::string> steps = read_members(listname);
+    printf(" Tracking over %ld timesteps\n", steps.size());
+    if (steps.size() < 2) {
+        std::cerr << " Tracking needs at least two timesteps in " << listname << std::endl;
+        exit(1);
+    }
+
+    RW::GridBlock<T> first;
+    first.filename = steps[0];
+    read_member(first, dims, vdim);
+
+    const bool is2D = (first.dims.size() == 2) || (first.dims[2] == 1);
+    if (is2D)
+        compute_cp_tracks<Tri2>(steps, first, 2, outfname, opts);
+    else if (opts.stencil == 6)
+        compute_cp_tracks<Tet6>(steps, first, 3, outfname, opts);
+    else
+        compute_cp_tracks<Tet5>(steps, first, 3, outfname, opts);
+}
+
+// -----------------------------------------------------------------------
+// the key of a run in the result cache: the hashes of the input files, the
+// other arguments, and the options (in any order)
+std::string cache_key(int argc, char *argv[], const Options &opts, ResultCache &cache) {
+
+    std::vector<std::string> parts (opts.given);
+    std::sort(parts.begin(), parts.end());
+
+    const std::string infilename (argv[1]);
+    const std::string ext = infilename.substr(infilename.find_last_of('.')+1);
+
+    parts.push_back(cache.file_hash(infilename));
+    if (argc == 3)
+        parts.push_back(cache.file_hash(argv[2]));
+    else {
+        for(int i = 2; i < argc; i++)
+            parts.push_back(argv[i]);
+    }
+
+    // the data of partitioned and multi-block files is in the files of their blocks
+    if (argc == 2 && (ext == "pvti" || ext == "vtm")) {
+
+        std::vector<RW::ImageBlock> blocks;
+        std::vector<size_t> global_dims;
+        RW::read_blocks_info(blocks, global_dims, infilename);
+        for(size_t b = 0; b < blocks.size(); b++)
+            parts.push_back(cache.file_hash(blocks[b].filename));
+    }
+    return ResultCache::key(parts);
 }
 
 // -----------------------------------------------------------------------
 void usage(int argc, char *argv[]) {
 
     printf("Usage:\n");
-    printf("  %s file.vti\n", argv[0]);
-    printf("  %s file1 X Y\n", argv[0]);
-    printf("  %s file1 X Y Z\n", argv[0]);
-    printf("  %s file1 file2\n", argv[0]);
+    printf("  %s [options] file.vti|file.vts\n", argv[0]);
+    printf("  %s [options] file.pvti|file.vtm\n", argv[0]);
+    printf("  %s [options] file.vtu\n", argv[0]);
+    printf("  %s [options] file.rcpb\n", argv[0]);
+    printf("  %s [options] file1|file.raw X Y\n", argv[0]);
+    printf("  %s [options] file1|file.raw X Y Z\n", argv[0]);
+    printf("  %s [options] file1 file2\n", argv[0]);
+    printf("  %s [options] file.q|file.f file.x\n", argv[0]);
+    printf("  %s [options] --ensemble members.txt [X Y [Z]]\n", argv[0]);
+    printf("  %s [options] --track timesteps.txt [X Y [Z]]\n", argv[0]);
+    printf("  %s [options] --stream fifo|-\n", argv[0]);
+    printf("  %s --serve=socket [--cache=N]\n", argv[0]);
+    printf("  %s --validate[=N]\n", argv[0]);
     printf("\n where,\n");
-    printf("   file.vti is a VTK image data file\n");
+    printf("   file.vti is a VTK image data file, and file.vts a VTK structured (curvilinear) grid file\n");
+    printf("   file.pvti|file.vtm is a partitioned or multi-block VTK image data file\n");
+    printf("   file.vtu is a VTK unstructured grid file (tets, pyramids, wedges, hexahedra, or triangles and quads)\n");
+    printf("   file.rcpb is a brick file written with --write-bricks\n");
     printf("   file1 is a text file where each line is: x y z vx vy vz (coordinates of points and corresponding vectors) [[x y vx vy: for the 2D case]]\n");
+    printf("   file.raw is a binary file of 2 or 3 doubles per vertex (vx vy [vz]), in row-major order\n");
     printf("   X Y are the dimensions of the regular grid (program creates trianglues automatically)\n");
     printf("   X Y Z are the dimensions of the regular grid (program creates tets automatically)\n");
     printf("   file2 is a text file where each line is: i1 i2 i3 i4 (indices of the 3/4 corners of a tri/tet)\n");
+    printf("   file.q|file.f is a binary plot3d solution or function file (one or more grids), and file.x the plot3d grid file\n");
+    printf("\n options,\n");
+    printf("   --stencil=5|6 subdivides each cube of a 3D regular grid into 5 (default) or 6 tets\n");
+    printf("   --periodic=xyz treats the given axes of a regular grid (read in full) as periodic\n");
+    printf("   --reorder=morton|hilbert reorders the cells of an unstructured mesh along a space-filling curve\n");
+    printf("   --pipeline[=L] reads, filters, detects, and writes a text grid in chunks of L cell layers (default 16) concurrently\n");
+    printf("   --stream reads a field stream from a FIFO (or stdin, given as -) in chunks of cell layers as they arrive, and\n"
+           "     writes the critical points of every chunk to stdout (the format is described in README.md)\n");
+    printf("   --write-bricks=file.rcpb converts a regular grid to a brick file, instead of detecting critical points\n");
+    printf("   --brick=N sets the number of cells per brick along each axis (default 32)\n");
+    printf("   --roi=i0:i1,j0:j1[,k0:k1] detects only in a box of vertex indices of a regular grid\n");
+    printf("   --box=x0:x1,y0:y1[,z0:z1] detects only in a box of physical coordinates of a regular or curvilinear grid\n");
+    printf("   --serve=socket serves requests (the arguments above, one line per request) on a Unix domain socket\n");
+    printf("   --validate[=N] compares the fast paths of the detector to the plain SoS path on N (default 200) random and\n"
+           "     degenerate fields, and writes a reproducer for every disagreement\n");
+    printf("   --numa pins the threads to the NUMA nodes in blocks, places the parts of the vector field and the mesh on the\n"
+           "     nodes of the threads that work on them, and reports the observed placement\n");
+    printf("   --huge-pages backs the vector field and the mesh by transparent huge pages\n");
+    printf("   --cache=N keeps the N most recently used datasets of the server in memory (default 4)\n");
+    printf("   --result-cache=dir reuses the result of a previous run with the same input files and options\n");
+    printf("   --float32 reads the vector field of a regular or plot3d grid in single precision (and raw files as floats)\n");
+    printf("   --gradient[=central|fourth] detects in the gradient of a scalar field (a .vti file, or a raw file of one value per vertex),\n"
+           "     computed with second (default) or fourth order finite differences\n");
+    printf("   --ensemble detects in the members of an ensemble on the same regular grid (.vti, raw, or text files with the\n"
+           "     dimensions X Y [Z]), listed one per line in members.txt, in one traversal of the grid\n");
+    printf("   --track follows the critical points over the timesteps of a field on a regular grid (files as for --ensemble),\n"
+           "     listed in order in timesteps.txt, and writes their tracks to timesteps.txt.tracks.txt\n");
+    printf("   --targets=file detects where the field of a regular grid equals any of the vectors in file (vx vy [vz] per line),\n"
+           "     instead of zero, in one traversal, and writes the simplices of the k-th target to <input>.target<k>.cp.txt\n");
+    printf("   --tile=N|X,Y[,Z] traverses a regular grid in tiles of N^3 (or X x Y x Z) cells (default: sized to the L2 cache, 0: off)\n");
+    printf("   --reorder-vertices also reorders the vertices (changes the SoS order of degenerate cases)\n");
 }
 
 // -----------------------------------------------------------------------
@@ -173,6 +1106,28 @@ void usage(int argc, char *argv[]) {
 
 int main (int argc, char *argv[]){
 
+    Options opts;
+    parse_options(argc, argv, opts);
+    Numa::init(opts.numa, opts.huge_pages);
+
+    if (!opts.serve.empty() && argc == 1) {
+        Server::run(opts.serve, opts.cache);
+        return 0;
+    }
+
+    if (opts.validate > 0) {
+        return (Validate::run(opts.validate) == 0) ? 0 : 1;
+    }
+
+    if (opts.stream) {
+        if (argc != 2) {
+            usage(argc, argv);
+            exit(1);
+        }
+        compute_cp_stream(argv[1], opts);
+        return 0;
+    }
+
     if(argc < 2 || argc > 5) {
         usage(argc, argv);
         exit(1);
@@ -182,23 +1137,155 @@ int main (int argc, char *argv[]){
     const std::string infilename (argv[1]);
     const std::string outfilename = std::string(infilename).append(".cp.txt");
 
+    const std::string ext = infilename.substr(infilename.find_last_of('.')+1);
+    if (opts.roi && (argc == 3 || ext == "pvti" || ext == "vtm" || ext == "vtu")) {
+        std::cerr << " A region of interest is supported only for regular grids (.vti, .vts, .rcpb, raw, and text grids)\n";
+        exit(1);
+    }
+
+    // blocks and bricks have no halo across the wrap, and meshes have no axes
+    const bool periodic = opts.periodic[0] || opts.periodic[1] || opts.periodic[2];
+    if (periodic && (argc == 3 || ext == "pvti" || ext == "vtm" || ext == "vtu" || ext == "rcpb")) {
+        std::cerr << " --periodic is supported only for regular and curvilinear grids read in full (.vti, .vts, raw, and text grids)\n";
+        exit(1);
+    }
+
+    if (!opts.targets.empty() && (argc == 3 || ext == "pvti" || ext == "vtm" || ext == "vtu" || ext == "rcpb")) {
+        std::cerr << " --targets is supported only for regular and curvilinear grids read in full (.vti, .vts, raw, and text grids)\n";
+        exit(1);
+    }
+
+    // a repeated run only copies the cached result
+    ResultCache *cache = 0;
+    std::string key;
+    if (!opts.result_cache.empty() && opts.bricks.empty() && !opts.ensemble && !opts.track && opts.targets.empty()) {
+
+        cache = new ResultCache(opts.result_cache);
+        key = cache_key(argc, argv, opts, *cache);
+        if (cache->fetch(key, outfilename)) {
+            printf(" Found cached result %s! Wrote %s\n", key.c_str(), outfilename.c_str());
+            delete cache;
+            return 0;
+        }
+    }
+
+    // -----------------------------------------------------------
+    // a scalar field: ./CriticalPointDetection --gradient file.vti (or file.raw X Y [Z])
+    if (opts.gradient) {
+
+        std::vector<size_t> dims;
+        for (int i = 2; i < argc; i++)
+            dims.push_back(size_t(atoi(argv[i])));
+
+        if (!((argc == 2 && ext == "vti") || ((argc == 4 || argc == 5) && ext == "raw"))) {
+            std::cerr << " --gradient needs a scalar field in a .vti file, or in a raw file with its dimensions\n";
+            exit(1);
+        }
+        if (opts.float32)
+            compute_cp_gradient<float>(infilename, dims, outfilename, opts);
+        else
+            compute_cp_gradient<double>(infilename, dims, outfilename, opts);
+    }
+
+    // -----------------------------------------------------------
+    // an ensemble: ./CriticalPointDetection --ensemble members.txt [X Y [Z]]
+    else if (opts.ensemble) {
+
+        std::vector<size_t> dims;
+        for (int i = 2; i < argc; i++)
+            dims.push_back(size_t(atoi(argv[i])));
+
+        if (argc == 3) {
+            std::cerr << " --ensemble needs the dimensions X Y [Z] of raw or text members\n";
+            exit(1);
+        }
+        const int vdim = (argc == 5) ? 3 : 2;
+        if (opts.float32)
+            compute_cp_ensemble<float>(infilename, vdim, dims, outfilename, opts);
+        else
+            compute_cp_ensemble<double>(infilename, vdim, dims, outfilename, opts);
+    }
+
+    // -----------------------------------------------------------
+    // a time-varying field: ./CriticalPointDetection --track timesteps.txt [X Y [Z]]
+    else if (opts.track) {
+
+        std::vector<size_t> dims;
+        for (int i = 2; i < argc; i++)
+            dims.push_back(size_t(atoi(argv[i])));
+
+        if (argc == 3) {
+            std::cerr << " --track needs the dimensions X Y [Z] of raw or text timesteps\n";
+            exit(1);
+        }
+        const int vdim = (argc == 5) ? 3 : 2;
+        const std::string tracksfilename = std::string(infilename).append(".tracks.txt");
+        if (opts.float32)
+            compute_cp_tracks<float>(infilename, vdim, dims, tracksfilename, opts);
+        else
+            compute_cp_tracks<double>(infilename, vdim, dims, tracksfilename, opts);
+    }
+
     // -----------------------------------------------------------
-    // 2 arguments: ./CriticalPointDetection file1.vti
-    if (argc == 2) {
+    // 2 arguments: ./CriticalPointDetection file1.vti (or .vts, .pvti, .vtm, .vtu, .rcpb)
+    else if (argc == 2 && ext == "rcpb") {
+        compute_cp_bricks(infilename, outfilename, opts);
+    }
+
+    else if (argc == 2) {
 
 #ifndef USE_VTK
         printf("VTK not available. Please reinstall with VTK libraries!\n");
         exit(1);
 #else
-        std::vector<size_t> dims;
-        vector<vec> vfield;
-        vector<point> points;
-
-        int vdim = RW::read_vti(dims, vfield, points, infilename);
-        compute_cp(vdim, dims, vfield, points, outfilename);
+        if (ext == "pvti" || ext == "vtm") {
+            if (opts.float32)
+                compute_cp_blocks<float>(infilename, outfilename, opts);
+            else
+                compute_cp_blocks<double>(infilename, outfilename, opts);
+        }
+        else if (ext == "vtu") {
+            vector<vec> vfield;
+            vector<point> points;
+            vector<ivec4> tets;
+            vector<ivec3> tris;
+            MixedMesh mesh;
+
+            const int vdim = RW::read_vtu(points, vfield, tets, tris, mesh, infilename);
+            if (mesh.num_cells() > 0) {
+
+                // cells with quad faces are split into simplices on the fly
+                CPDetector<double> *CPD = new CPDetector<double>(&vfield, vdim);
+                CPD->compute(mesh);
+                RW::write_cp(outfilename, CPD->get_CP(), mesh, points);
+                delete CPD;
+            }
+            else if (vdim == 2)
+                compute_cp(points, vfield, tris, outfilename, opts);
+            else
+                compute_cp(points, vfield, tets, outfilename, opts);
+        }
+        else if (ext == "vts") {
+            if (opts.float32)
+                compute_cp_vts<float>(infilename, outfilename, opts);
+            else
+                compute_cp_vts<double>(infilename, outfilename, opts);
+        }
+        else if (opts.float32) {
+            compute_cp_vti<float>(infilename, outfilename, opts);
+        }
+        else {
+            compute_cp_vti<double>(infilename, outfilename, opts);
+        }
 #endif
     }
 
+    // -----------------------------------------------------------
+    // 3 arguments: ./CriticalPointDetection file.q file.x (plot3d)
+    else if (argc == 3 && (ext == "q" || ext == "f")) {
+        compute_cp_plot3d(infilename, argv[2], outfilename, opts);
+    }
+
     // -----------------------------------------------------------
     // 3 arguments: ./CriticalPointDetection file1 file2
     else if (argc == 3) {
@@ -225,22 +1312,7 @@ int main (int argc, char *argv[]){
             RW::read_text(points, vfield, infilename, vdim);
             RW::read_text(tris, tri_file);
 
-            CPDetector *CPD = new CPDetector(&vfield, &tris);
-            CPD->compute();
-
-            const std::vector<size_t> &cp = CPD->get_CP();
-
-            /*
-            // display critical points
-            for(size_t i = 0; i < cp.size(); i++){
-
-                size_t t = cp[i];
-                point p = RW::get_centroid(tets[t], points);
-                printf(" CP exists in simplex %d at [%f, %f, %f]\n", t, p[0], p[1], p[2]);
-            }*/
-
-            RW::write_cp(outfilename, cp, tris, points);
-            delete CPD;
+            compute_cp(points, vfield, tris, outfilename, opts);
         }
 
         else if (ncols_val == 6 && ncols_tri == 4) {
@@ -256,22 +1328,7 @@ int main (int argc, char *argv[]){
             RW::read_text(points, vfield, infilename, vdim);
             RW::read_text(tets, tri_file);
 
-            CPDetector *CPD = new CPDetector(&vfield, &tets);
-            CPD->compute();
-
-            const std::vector<size_t> &cp = CPD->get_CP();
-
-            /*
-            // display critical points
-            for(size_t i = 0; i < cp.size(); i++){
-
-                size_t t = cp[i];
-                point p = RW::get_centroid(tets[t], points);
-                printf(" CP exists in simplex %d at [%f, %f, %f]\n", t, p[0], p[1], p[2]);
-            }*/
-
-            RW::write_cp(outfilename, cp, tets, points);
-            delete CPD;
+            compute_cp(points, vfield, tets, outfilename, opts);
         }
 
         else {
@@ -286,26 +1343,22 @@ int main (int argc, char *argv[]){
 
         const int vdim = 2;
         const std::vector<size_t> dims ({size_t(atoi(argv[2])), size_t(atoi(argv[3]))});
-
-        vector<vec> vfield;
-        vector<point> points;
-
-        RW::read_text(points, vfield, infilename, vdim);
-        compute_cp(vdim, dims, vfield, points, outfilename);
+        if (opts.float32)
+            compute_cp_grid<float>(infilename, vdim, dims, outfilename, opts);
+        else
+            compute_cp_grid<double>(infilename, vdim, dims, outfilename, opts);
     }
 
     // -----------------------------------------------------------
     // 5 arguments: ./CriticalPointDetection file1 X Y Z
-    else if (argc == 3){
+    else if (argc == 5){
 
         const int vdim = 3;
         const std::vector<size_t> dims ({size_t(atoi(argv[2])), size_t(atoi(argv[3])), size_t(atoi(argv[4]))});
-
-        vector<vec> vfield;
-        vector<point> points;
-
-        RW::read_text(points, vfield, infilename, vdim);
-        compute_cp(vdim, dims, vfield, points, outfilename);
+        if (opts.float32)
+            compute_cp_grid<float>(infilename, vdim, dims, outfilename, opts);
+        else
+            compute_cp_grid<double>(infilename, vdim, dims, outfilename, opts);
     }
 
     // -----------------------------------------------------------
@@ -313,5 +1366,10 @@ int main (int argc, char *argv[]){
         std::cerr << "Invalid number of arguments!\n";
         exit(1);
     }
+
+    if (cache) {
+        cache->store(key, outfilename);
+        delete cache;
+    }
     return 0;
 }
@@ -0,0 +1,295 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <iostream>
+
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "numa.h"
+#include "parallel.h"
+
+using namespace std;
+
+// -----------------------------------------------------------------------
+// the node of every thread (empty until the threads are pinned)
+static vector<int> thread_node;
+static bool use_huge_pages = false;
+
+static const size_t HUGE_PAGE = size_t(2) << 20;
+
+static size_t page_size() {
+#ifdef __linux__
+    static const size_t size = size_t(sysconf(_SC_PAGESIZE));
+    return size;
+#else
+    return 4096;
+#endif
+}
+
+bool Numa::active() {
+    return !thread_node.empty();
+}
+
+#ifdef __linux__
+// parse a list of cpus, such as 0-3,8-11
+static void parse_cpulist(const string &list, cpu_set_t &set) {
+
+    CPU_ZERO(&set);
+    size_t pos = 0;
+    while (pos < list.size()) {
+
+        const size_t comma = list.find(',', pos);
+        const string range = list.substr(pos, comma == string::npos ? string::npos : comma-pos);
+        pos = (comma == string::npos) ? list.size() : comma+1;
+
+        const size_t dash = range.find('-');
+        const int lo = atoi(range.c_str());
+        const int hi = (dash == string::npos) ? lo : atoi(range.c_str()+dash+1);
+        for(int c = lo; c <= hi && c < CPU_SETSIZE; c++)
+            CPU_SET(c, &set);
+    }
+}
+
+// the nodes that have cpus this process may run on, and these cpus
+static void read_nodes(const cpu_set_t &allowed, vector<int> &nodes, vector<cpu_set_t> &cpus) {
+
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (dir) {
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+
+            int node;
+            char rest;
+            if (sscanf(entry->d_name, "node%d%c", &node, &rest) != 1)
+                continue;
+
+            ifstream infile(("/sys/devices/system/node/" + string(entry->d_name) + "/cpulist").c_str());
+            string list;
+            if (!(infile >> list))
+                continue;
+
+            cpu_set_t set;
+            parse_cpulist(list, set);
+            CPU_AND(&set, &set, &allowed);
+            if (CPU_COUNT(&set) == 0)
+                continue;
+
+            // keep the nodes sorted by id
+            size_t i = nodes.size();
+            nodes.push_back(node);
+            cpus.push_back(set);
+            for(; i > 0 && nodes[i-1] > node; i--){
+                swap(nodes[i-1], nodes[i]);
+                swap(cpus[i-1], cpus[i]);
+            }
+        }
+        closedir(dir);
+    }
+
+    // without the topology, all cpus are on one node
+    if (nodes.empty()) {
+        nodes.push_back(0);
+        cpus.push_back(allowed);
+    }
+}
+#endif
+
+// -----------------------------------------------------------------------
+void Numa::init(bool numa, bool huge_pages) {
+
+#ifdef __linux__
+#ifdef MADV_HUGEPAGE
+    use_huge_pages = huge_pages;
+    if (huge_pages) {
+
+        // madvise has no effect if transparent huge pages are disabled
+        ifstream infile("/sys/kernel/mm/transparent_hugepage/enabled");
+        string modes;
+        getline(infile, modes);
+        if (modes.find("[never]") != string::npos)
+            printf(" Transparent huge pages are disabled on this system\n");
+    }
+#else
+    if (huge_pages)
+        printf(" Huge pages are not supported on this system\n");
+#endif
+
+    if (!numa)
+        return;
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        cerr << " Unable to get the cpus of the process: " << strerror(errno) << endl;
+        exit(1);
+    }
+
+    vector<int> nodes;
+    vector<cpu_set_t> cpus;
+    read_nodes(allowed, nodes, cpus);
+
+    // consecutive threads are pinned to the same node
+    const int nthreads = Parallel::num_threads();
+    const int nnodes = int(nodes.size());
+    thread_node.assign(nthreads, 0);
+    vector<int> nthreads_node (nnodes, 0);
+    int failed = 0;
+
+    #pragma omp parallel num_threads(nthreads) reduction(+:failed)
+    {
+        const int t = Parallel::thread_num();
+        const int n = int(size_t(t) * size_t(nnodes) / size_t(nthreads));
+        if (sched_setaffinity(0, sizeof(cpus[n]), &cpus[n]) != 0)
+            failed++;
+        thread_node[t] = nodes[n];
+    }
+
+    if (failed > 0) {
+        cerr << " Unable to pin " << failed << " threads to their nodes" << endl;
+        exit(1);
+    }
+
+    for(int t = 0; t < nthreads; t++)
+        nthreads_node[size_t(t) * size_t(nnodes) / size_t(nthreads)]++;
+
+    printf(" Pinned %d threads to %d NUMA node%s (", nthreads, nnodes, (nnodes > 1) ? "s" : "");
+    for(int n = 0; n < nnodes; n++)
+        printf("%s%d on node %d", (n > 0 ? ", " : ""), nthreads_node[n], nodes[n]);
+    printf(")\n");
+#else
+    if (numa || huge_pages)
+        printf(" NUMA placement and huge pages are not supported on this system\n");
+#endif
+}
+
+// -----------------------------------------------------------------------
+void Numa::advise(void *p, size_t bytes) {
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (!use_huge_pages || bytes < HUGE_PAGE)
+        return;
+
+    const uintptr_t first = (uintptr_t(p) + HUGE_PAGE-1) & ~uintptr_t(HUGE_PAGE-1);
+    const uintptr_t last = (uintptr_t(p) + bytes) & ~uintptr_t(HUGE_PAGE-1);
+    if (last > first)
+        madvise(reinterpret_cast<void*>(first), last-first, MADV_HUGEPAGE);
+#else
+    (void) p;   (void) bytes;
+#endif
+}
+
+// the base pages that hold [p, p+bytes): npages of the given size, from first.
+// even with huge pages, every base page is touched (and sampled), since the
+// head and the tail of an array, and any range the kernel could not back by
+// huge pages, are mapped in base pages
+static void pages_of(const void *p, size_t bytes, uintptr_t &first, size_t &npages, size_t &page) {
+
+    page = page_size();
+    first = uintptr_t(p) & ~uintptr_t(page-1);
+    npages = (uintptr_t(p) + bytes - first + page-1) / page;
+}
+
+// the thread whose part of n items holds item i
+static int owner(size_t i, size_t n, int nthreads) {
+
+    int t = int(i * size_t(nthreads) / n);
+    size_t lo, hi;
+    Parallel::part(n, t, nthreads, lo, hi);
+    for(; i < lo; Parallel::part(n, t, nthreads, lo, hi))   t--;
+    for(; i >= hi; Parallel::part(n, t, nthreads, lo, hi))  t++;
+    return t;
+}
+
+void Numa::touch(void *p, size_t bytes) {
+
+    if (!active() || bytes == 0)
+        return;
+
+    uintptr_t first;
+    size_t npages, page;
+    pages_of(p, bytes, first, npages, page);
+    const uintptr_t begin = uintptr_t(p), end = begin + bytes;
+    const int nthreads = int(thread_node.size());
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+        size_t lo, hi;
+        Parallel::part(npages, Parallel::thread_num(), nthreads, lo, hi);
+
+        // only the bytes of the array are written, never its neighbors on a shared page
+        for(size_t i = lo; i < hi; i++){
+            const uintptr_t a = max(begin, first + i*page);
+            if (a < end)
+                *reinterpret_cast<volatile char*>(a) = 0;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------
+void Numa::report(const char *name, const void *p, size_t bytes) {
+
+    if (!active() || bytes == 0)
+        return;
+
+#ifdef __linux__
+    uintptr_t first;
+    size_t npages, page;
+    pages_of(p, bytes, first, npages, page);
+    const int nthreads = int(thread_node.size());
+
+    // at most this many pages, evenly spaced
+    const size_t nsamples = min(npages, size_t(1024));
+    vector<void*> pages (nsamples);
+    vector<int> expected (nsamples), status (nsamples, 0);
+
+    for(size_t s = 0; s < nsamples; s++){
+
+        const size_t i = s * npages / nsamples;
+        pages[s] = reinterpret_cast<void*>(max(uintptr_t(p), first + i*page));
+
+        expected[s] = thread_node[owner(i, npages, nthreads)];
+    }
+
+    // with no target nodes, move_pages only reports the node of every page
+    if (syscall(SYS_move_pages, 0, nsamples, pages.data(), NULL, status.data(), 0) != 0) {
+        printf(" NUMA placement of %s: unknown (%s)\n", name, strerror(errno));
+        return;
+    }
+
+    size_t local = 0, remote = 0, absent = 0;
+    for(size_t s = 0; s < nsamples; s++){
+        if (status[s] < 0)                  absent++;
+        else if (status[s] == expected[s])  local++;
+        else                                remote++;
+    }
+
+    printf(" NUMA placement of %s: %.1f%% local (%ld of %ld sampled pages, %ld remote, %ld not resident)\n",
+           name, 100.0 * double(local) / double(nsamples), local, nsamples, remote, absent);
+#else
+    (void) name;    (void) p;
+#endif
+}
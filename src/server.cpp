@@ -0,0 +1,505 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+
+#include <list>
+#include <map>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "options.h"
+#include "CP.h"
+
+using namespace std;
+
+// -----------------------------------------------------------------------
+// datasets kept in memory
+
+struct Result {
+    vector<size_t> ids;
+    vector<point> centroids;
+};
+
+struct Dataset {
+
+    string key;                     // the arguments of the request, other than options
+    string stamp;                   // the sizes and modification times of its files
+    int vdim = 0;
+
+    // regular grids
+    vector<size_t> dims;
+    double origin[3], spacing[3];
+    bool uniform = true;            // else, a curvilinear grid
+
+    // unstructured meshes
+    vector<ivec4> tets;
+    vector<ivec3> tris;
+
+    vector<vec> vfield;
+    vector<point> points;
+
+    // critical points of the whole dataset, by the options that change them
+    map<string, Result> results;
+};
+
+static bool can_open(const string &filename) {
+    ifstream infile(filename.c_str());
+    return infile.is_open();
+}
+
+// the sizes and modification times of the files of a request, which change when a file is rewritten
+static string file_stamp(const vector<string> &args) {
+
+    const size_t nfiles = (args.size() == 2) ? 2 : 1;
+    string stamp;
+    for(size_t i = 0; i < nfiles && i < args.size(); i++){
+
+        struct stat st;
+        if (stat(args[i].c_str(), &st) != 0)
+            return string();
+        stamp += to_string(st.st_size) + ":" + to_string(st.st_mtim.tv_sec) + "." + to_string(st.st_mtim.tv_nsec) + " ";
+    }
+    return stamp;
+}
+
+static string extension(const string &filename) {
+    return filename.substr(filename.find_last_of('.')+1);
+}
+
+// load the dataset given by the arguments of a request. returns an error message, or an empty string
+static string load(Dataset &ds, const vector<string> &args) {
+
+    const size_t nfiles = (args.size() == 2) ? 2 : 1;
+    for(size_t i = 0; i < nfiles; i++){
+        if (!can_open(args[i]))
+            return "unable to open file " + args[i];
+    }
+
+    // file.vti or file.vtu
+    if (args.size() == 1) {
+#ifndef USE_VTK
+        return "VTK not available";
+#else
+        const string ext = extension(args[0]);
+        if (ext == "vti") {
+            ds.vdim = RW::read_vti(ds.dims, ds.vfield, ds.points, args[0]);
+            ds.uniform = RW::grid_geometry(ds.dims, ds.points, ds.origin, ds.spacing);
+            return string();
+        }
+        if (ext == "vtu") {
+            MixedMesh mesh;
+            ds.vdim = RW::read_vtu(ds.points, ds.vfield, ds.tets, ds.tris, mesh, args[0]);
+            return (mesh.num_cells() > 0) ? "meshes with mixed cells are not supported by the server" : string();
+        }
+        return "unsupported file " + args[0];
+#endif
+    }
+
+    // file1 file2
+    if (args.size() == 2) {
+
+        const int ncols_val = RW::count_columns(args[0]);
+        const int ncols_tri = RW::count_columns(args[1]);
+
+        if (ncols_val == 4 && ncols_tri == 3) {
+            ds.vdim = 2;
+            RW::read_text(ds.points, ds.vfield, args[0], ds.vdim);
+            RW::read_text(ds.tris, args[1]);
+        }
+        else if (ncols_val == 6 && ncols_tri == 4) {
+            ds.vdim = 3;
+            RW::read_text(ds.points, ds.vfield, args[0], ds.vdim);
+            RW::read_text(ds.tets, args[1]);
+        }
+        else
+            return "invalid files/dimensionality";
+
+        // the vertex ids must be valid
+        const size_t nverts = ds.vfield.size();
+        for(size_t i = 0; i < ds.tris.size(); i++)
+            for(int k = 0; k < 3; k++)
+                if (ds.tris[i][k] < 0 || size_t(ds.tris[i][k]) >= nverts)    return "invalid vertex id in " + args[1];
+        for(size_t i = 0; i < ds.tets.size(); i++)
+            for(int k = 0; k < 4; k++)
+                if (ds.tets[i][k] < 0 || size_t(ds.tets[i][k]) >= nverts)    return "invalid vertex id in " + args[1];
+        return string();
+    }
+
+    // file1|file.raw X Y [Z]
+    ds.vdim = int(args.size()) - 1;
+    for(size_t i = 1; i < args.size(); i++){
+        const long n = atol(args[i].c_str());
+        if (n < 2)
+            return "invalid dimension " + args[i];
+        ds.dims.push_back(size_t(n));
+    }
+
+    size_t npoints = 1;
+    for(size_t a = 0; a < ds.dims.size(); a++)
+        npoints *= ds.dims[a];
+
+    if (extension(args[0]) == "raw") {
+
+        ifstream infile(args[0].c_str(), ios::binary | ios::ate);
+        if (size_t(infile.tellg()) != npoints*ds.vdim*sizeof(double))
+            return "the size of " + args[0] + " does not match the dimensions";
+
+        RW::ImageBlock block;
+        block.filename = args[0];
+        RW::read_raw(block, ds.dims, ds.vdim, RW::Box());
+        ds.vfield.swap(block.vfield);
+        ds.points.swap(block.points);
+    }
+    else {
+        RW::read_text(ds.points, ds.vfield, args[0], ds.vdim);
+        if (ds.vfield.size() != npoints)
+            return "the number of vectors in " + args[0] + " does not match the dimensions";
+    }
+
+    ds.uniform = RW::grid_geometry(ds.dims, ds.points, ds.origin, ds.spacing);
+    return string();
+}
+
+// -----------------------------------------------------------------------
+// detection on a whole dataset
+
+template <typename Stencil>
+static void detect(Dataset &ds, const Options &opts, Result &res) {
+
+    StructuredGrid<Stencil> grid(ds.dims, opts.periodic);
+
+    CPDetector<double> *CPD = new CPDetector<double>(&ds.vfield, Stencil::dim);
+    CPD->compute(grid);
+
+    const vector<size_t> &cp = CPD->get_CP();
+    for(size_t i = 0; i < cp.size(); i++){
+        res.ids.push_back(cp[i]);
+        res.centroids.push_back(grid.centroid(cp[i], ds.points));
+    }
+    delete CPD;
+}
+
+template <typename T>
+static void detect(Dataset &ds, vector<T> &cells, Result &res) {
+
+    CPDetector<double> *CPD = new CPDetector<double>(&ds.vfield, &cells);
+    CPD->compute();
+
+    const vector<size_t> &cp = CPD->get_CP();
+    for(size_t i = 0; i < cp.size(); i++){
+        res.ids.push_back(cp[i]);
+        res.centroids.push_back(RW::get_centroid(cells[cp[i]], ds.points));
+    }
+    delete CPD;
+}
+
+// the critical points of a grid in the cells covered by a region
+template <typename Stencil>
+static void select_region(const Dataset &ds, const Options &opts, const size_t lo[3], const size_t hi[3],
+                          const Result &all, Result &res) {
+
+    StructuredGrid<Stencil> grid(ds.dims, opts.periodic);
+    const size_t CX = grid.num_cells(0), CY = grid.num_cells(1);
+
+    for(size_t i = 0; i < all.ids.size(); i++){
+
+        const size_t c = all.ids[i] / Stencil::nsimplices;
+        const size_t ijk[3] = {c % CX, (c / CX) % CY, c / (CX*CY)};
+
+        bool inside = true;
+        for(int a = 0; a < Stencil::dim; a++)
+            inside = inside && (lo[a] <= ijk[a]) && (ijk[a] < hi[a]);
+
+        if (inside) {
+            res.ids.push_back(all.ids[i]);
+            res.centroids.push_back(all.centroids[i]);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------
+// requests
+
+class Handler {
+
+    list<Dataset> datasets;         // the most recently used first
+    const size_t max_datasets;
+
+    // find or load the dataset of a request
+    string get(const vector<string> &args, Dataset *&ds) {
+
+        string key;
+        for(size_t i = 0; i < args.size(); i++)
+            key += (i ? " " : "") + args[i];
+
+        // a dataset whose files changed on disk is loaded again, together with its results
+        const string stamp = file_stamp(args);
+        for(list<Dataset>::iterator it = datasets.begin(); it != datasets.end(); it++){
+            if (it->key != key)
+                continue;
+            if (!stamp.empty() && it->stamp == stamp) {
+                datasets.splice(datasets.begin(), datasets, it);
+                ds = &datasets.front();
+                return string();
+            }
+            datasets.erase(it);
+            break;
+        }
+
+        datasets.push_front(Dataset());
+        datasets.front().key = key;
+        datasets.front().stamp = stamp;
+        const string error = load(datasets.front(), args);
+        if (!error.empty()) {
+            datasets.pop_front();
+            return error;
+        }
+
+        while (datasets.size() > max_datasets)
+            datasets.pop_back();
+
+        ds = &datasets.front();
+        return string();
+    }
+
+    // the critical points of a dataset for the given options
+    string detect(Dataset &ds, const Options &opts, Result &res) {
+
+        const bool grid = !ds.dims.empty();
+        if (!grid && (opts.roi || opts.periodic[0] || opts.periodic[1] || opts.periodic[2]))
+            return "regions and periodic axes are supported only for regular grids";
+
+        if (grid && ds.vdim == 3 && opts.stencil == 5 && !StructuredGrid<Tet5>::is_conforming(ds.dims, opts.periodic))
+            return "the 5-tet stencil does not match across a periodic axis with an odd number of cells";
+
+        // as on the command line: a region does not wrap around a periodic axis
+        if (opts.roi && (opts.periodic[0] || opts.periodic[1] || opts.periodic[2]))
+            return "a region of interest cannot be combined with --periodic";
+
+        // the options that change the result
+        string key;
+        if (grid) {
+            key = to_string(opts.stencil);
+            for(int a = 0; a < 3; a++)
+                key += opts.periodic[a] ? "xyz"[a] : '-';
+        }
+
+        map<string, Result>::iterator it = ds.results.find(key);
+        if (it == ds.results.end()) {
+
+            Result all;
+            if (ds.vdim == 2 && grid)           ::detect<Tri2>(ds, opts, all);
+            else if (grid && opts.stencil == 6) ::detect<Tet6>(ds, opts, all);
+            else if (grid)                      ::detect<Tet5>(ds, opts, all);
+            else if (ds.vdim == 2)              ::detect(ds, ds.tris, all);
+            else                                ::detect(ds, ds.tets, all);
+
+            it = ds.results.insert(make_pair(key, all)).first;
+        }
+
+        if (!opts.roi) {
+            res = it->second;
+            return string();
+        }
+
+        size_t lo[3], hi[3];
+        const bool found = (ds.uniform || !opts.box.physical) ? RW::covering_region(opts.box, ds.dims, ds.origin, ds.spacing, lo, hi)
+                                                              : RW::covering_region(opts.box, ds.dims, ds.points, lo, hi);
+        if (!found)
+            return "the region of interest does not intersect the grid";
+
+        if (ds.vdim == 2)               select_region<Tri2>(ds, opts, lo, hi, it->second, res);
+        else if (opts.stencil == 6)     select_region<Tet6>(ds, opts, lo, hi, it->second, res);
+        else                            select_region<Tet5>(ds, opts, lo, hi, it->second, res);
+        return string();
+    }
+
+public:
+    bool stop = false;
+
+    Handler(size_t max_datasets_) : max_datasets(max_datasets_) {}
+
+    // the reply to a request
+    string handle(const string &line) {
+
+        vector<string> args;
+        Options opts;
+
+        istringstream iss(line);
+        string arg;
+        while (iss >> arg) {
+
+            if (arg.compare(0, 2, "--") != 0) {
+                args.push_back(arg);
+                continue;
+            }
+
+            // only the options that select what to detect
+            const string name = arg.substr(2, arg.find('=') == string::npos ? string::npos : arg.find('=')-2);
+            if (name != "stencil" && name != "periodic" && name != "roi" && name != "box")
+                return "error option " + arg + " is not supported by the server\n";
+
+            const string error = parse_option(arg, opts);
+            if (!error.empty())
+                return "error" + error + "\n";
+        }
+
+        if (args.size() == 1 && args[0] == "shutdown") {
+            stop = true;
+            return "ok 0\n";
+        }
+        if (args.empty() || args.size() > 4)
+            return "error invalid number of arguments\n";
+
+        Dataset *ds = 0;
+        Result res;
+
+        string error = get(args, ds);
+        if (error.empty())
+            error = detect(*ds, opts, res);
+        if (!error.empty())
+            return "error " + error + "\n";
+
+        ostringstream reply;
+        reply << "ok " << res.ids.size() << "\n";
+        for(size_t i = 0; i < res.ids.size(); i++){
+            const point &p = res.centroids[i];
+            reply << res.ids[i] << " " << p[0] << " " << p[1] << " " << p[2] << "\n";
+        }
+        return reply.str();
+    }
+};
+
+// -----------------------------------------------------------------------
+// socket
+
+static bool send_all(int fd, const string &data) {
+
+    size_t sent = 0;
+    while (sent < data.size()) {
+        const ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += size_t(n);
+    }
+    return true;
+}
+
+// the longest request line. a client that sends more without a newline is dropped
+static const size_t MAX_LINE = size_t(8) << 10;
+
+void Server::run(const std::string &path, size_t max_datasets) {
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        cerr << " Socket path " << path << " is too long\n";
+        exit(1);
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path)-1);
+
+    const int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (lfd < 0 || ::bind(lfd, (sockaddr*) &addr, sizeof(addr)) < 0 || listen(lfd, 16) < 0) {
+        cerr << " Unable to listen on " << path << ": " << strerror(errno) << endl;
+        exit(1);
+    }
+
+    printf(" Serving on %s\n", path.c_str());
+    fflush(stdout);
+
+    Handler handler (max_datasets);
+
+    // the listening socket, and the connected clients with their unfinished lines
+    vector<pollfd> fds (1);
+    vector<string> pending (1);
+    fds[0].fd = lfd;
+    fds[0].events = POLLIN;
+
+    while (!handler.stop) {
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            cerr << " poll failed: " << strerror(errno) << endl;
+            break;
+        }
+
+        for(size_t i = fds.size(); i-- > 1; ){
+
+            if (fds[i].revents == 0)
+                continue;
+
+            char buf[4096];
+            const ssize_t n = recv(fds[i].fd, buf, sizeof(buf), 0);
+            bool open = (n > 0) || (n < 0 && errno == EINTR);
+            if (n > 0)
+                pending[i].append(buf, size_t(n));
+
+            for(size_t eol = pending[i].find('\n'); open && eol != string::npos; eol = pending[i].find('\n')){
+
+                const string line = pending[i].substr(0, eol);
+                pending[i].erase(0, eol+1);
+
+                const auto start = chrono::steady_clock::now();
+                const string reply = handler.handle(line);
+                const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+                printf(" Request [%s]: %s (%.2f ms)\n", line.c_str(), reply.substr(0, reply.find('\n')).c_str(), ms);
+                fflush(stdout);
+
+                open = send_all(fds[i].fd, reply) && !handler.stop;
+            }
+
+            if (open && pending[i].size() > MAX_LINE) {
+                printf(" Request longer than %ld bytes: closing the client\n", MAX_LINE);
+                fflush(stdout);
+                send_all(fds[i].fd, "error request longer than " + to_string(MAX_LINE) + " bytes\n");
+                open = false;
+            }
+
+            if (!open) {
+                close(fds[i].fd);
+                fds.erase(fds.begin() + i);
+                pending.erase(pending.begin() + i);
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            const int cfd = accept(lfd, 0, 0);
+            if (cfd >= 0) {
+                pollfd p;
+                p.fd = cfd;
+                p.events = POLLIN;
+                p.revents = 0;
+                fds.push_back(p);
+                pending.push_back(string());
+            }
+        }
+    }
+
+    for(size_t i = 0; i < fds.size(); i++)
+        close(fds[i].fd);
+    unlink(path.c_str());
+    printf(" Done! Server stopped\n");
+}
@@ -0,0 +1,330 @@
+/**
+ Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+ Produced at the Lawrence Livermore National Laboratory
+ Written by Harsh Bhatia (bhatia4@llnl.gov).
+ CODE-701040.
+ All rights reserved.
+
+ This file is part of RobustCriticalPointDetection v1.0.
+
+ For details, see https://github.com/bhatiaharsh/RobustCriticalPointDetection.
+ For more details on the Licence, please read LICENCE file.
+*/
+
+
+#include <random>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+
+#include "validate.h"
+#include "CP.h"
+#include "ensemble.h"
+
+using namespace std;
+
+// -----------------------------------------------------------------------
+// fields
+
+enum Kind { RANDOM, INTEGER, ZEROS, DUPLICATES, THRESHOLD, NKINDS };
+static const char *kind_names[NKINDS] = { "random", "integer", "zeros", "duplicates", "threshold" };
+
+static vector<vec> generate(Kind kind, size_t n, int dim, mt19937_64 &rng) {
+
+    uniform_real_distribution<double> unit (-1.0, 1.0);
+    uniform_int_distribution<int> small (-2, 2);
+
+    vector<vec> field (n);
+    for(size_t v = 0; v < n; v++){
+    for(int d = 0; d < dim; d++){
+
+        double val = 0;
+        switch(kind){
+            case INTEGER:   val = small(rng);                                           break;
+            case ZEROS:     val = (rng() % 2) ? 0.0 : unit(rng);                        break;
+            case THRESHOLD: val = small(rng) * 0.5 * CPDetector<double>::SOS_EPS;       break;
+            default:        val = unit(rng);                                            break;
+        }
+        field[v][d] = double(float(val));
+    }
+    }
+
+    if(kind == DUPLICATES){
+        for(size_t v = 0; v < n; v++){
+            if(rng() % 3 == 0)
+                field[v] = field[rng() % n];
+        }
+    }
+    return field;
+}
+
+// -----------------------------------------------------------------------
+// configurations of the detector
+
+struct Config {
+    bool filter = true;
+    bool sweep = true;
+    bool ranks = true;
+    vector<size_t> tile;        // empty: sized to the cache
+};
+
+template <typename Stencil, typename T>
+static vector<size_t> detect(const StructuredGrid<Stencil> &grid, const vector<Vec<3,T> > &field, const Config &config) {
+
+    CPDetector<T> *CPD = new CPDetector<T>(&field, Stencil::dim);
+    CPD->set_quiet(true);
+    CPD->use_filter(config.filter);
+    CPD->use_edge_sweep(config.sweep);
+    CPD->use_ranks(config.ranks);
+    CPD->use_tiles(config.tile);
+    CPD->compute(grid);
+
+    const vector<size_t> cp (CPD->get_CP());
+    delete CPD;
+    return cp;
+}
+
+// the exact tests of given candidates (as in the pipeline), with all simplices as candidates
+template <typename Stencil>
+static vector<size_t> detect_candidates(const StructuredGrid<Stencil> &grid, const vector<vec> &field) {
+
+    vector<uint32_t> candidates (grid.num_simplices());
+    for(size_t s = 0; s < candidates.size(); s++)
+        candidates[s] = uint32_t(s);
+
+    CPDetector<double> *CPD = new CPDetector<double>(&field, Stencil::dim);
+    CPD->set_quiet(true);
+    CPD->compute(grid, candidates);
+
+    const vector<size_t> cp (CPD->get_CP());
+    delete CPD;
+    return cp;
+}
+
+// zero as one of several targets, the others being the values of random vertices
+template <typename Stencil>
+static vector<size_t> detect_targets(const StructuredGrid<Stencil> &grid, const vector<vec> &field, mt19937_64 &rng) {
+
+    const size_t K = 3, zero = rng() % K;
+
+    vector<point> targets (K);
+    for(size_t k = 0; k < K; k++){
+        if(k != zero)
+            targets[k] = point(field[rng() % field.size()]);
+    }
+
+    CPDetector<double> *CPD = new CPDetector<double>(&field, Stencil::dim);
+    CPD->set_quiet(true);
+    CPD->set_targets(targets);
+    CPD->compute(grid);
+
+    const vector<size_t> cp (CPD->get_CP(zero));
+    delete CPD;
+    return cp;
+}
+
+// the field as one member of an ensemble of random fields
+template <typename Stencil>
+static vector<size_t> detect_ensemble(const StructuredGrid<Stencil> &grid, const vector<vec> &field, mt19937_64 &rng) {
+
+    const size_t N = 3, member = rng() % N;
+    const size_t n = field.size();
+
+    vector<vec> values (n*N);
+    for(size_t m = 0; m < N; m++){
+
+        const vector<vec> other = (m == member) ? field : generate(RANDOM, n, Stencil::dim, rng);
+        for(size_t v = 0; v < n; v++)
+            values[v*N + m] = other[v];
+    }
+
+    vector<vector<size_t> > cps;
+    Ensemble::detect(grid, values, N, cps, true);
+    return cps[member];
+}
+
+// -----------------------------------------------------------------------
+// reproducers
+
+struct Trial {
+    size_t id;
+    Kind kind;
+    vector<size_t> dims;
+    vector<bool> periodic;
+    string options;             // the command line options of the grid
+};
+
+template <typename Stencil>
+static void report(const Trial &trial, const string &config, const vector<size_t> &ref, const vector<size_t> &cp,
+                   const StructuredGrid<Stencil> &grid, const vector<vec> &field) {
+
+    vector<size_t> diff;
+    set_symmetric_difference(ref.begin(), ref.end(), cp.begin(), cp.end(), back_inserter(diff));
+
+    string dims;
+    for(size_t a = 0; a < trial.dims.size(); a++)
+        dims += " " + to_string(trial.dims[a]);
+
+    const size_t s = diff[0];
+    const bool missed = binary_search(ref.begin(), ref.end(), s);
+    printf(" Trial %ld (%s field,%s%s): %s %s simplex %ld, and disagrees on %ld simplices\n",
+           trial.id, kind_names[trial.kind], dims.c_str(), trial.options.c_str(),
+           config.c_str(), missed ? "misses" : "wrongly reports", s, diff.size());
+
+    const string base = "validate_" + to_string(trial.id);
+
+    // the whole field
+    ofstream raw ((base + ".raw").c_str(), ios::binary);
+    for(size_t v = 0; v < field.size(); v++)
+        raw.write(reinterpret_cast<const char*>(&field[v][0]), Stencil::dim*sizeof(double));
+    raw.close();
+
+    // the simplex alone. its vertices are numbered in the order of their ids, which keeps their SoS order
+    const typename StructuredGrid<Stencil>::simplex_t simplex = grid[s];
+
+    vector<size_t> ids (&simplex[0], &simplex[0] + Stencil::dim+1);
+    sort(ids.begin(), ids.end());
+
+    const size_t X = trial.dims[0], Y = trial.dims[1];
+    ofstream txt ((base + "_simplex.txt").c_str());
+    txt.precision(17);
+    for(size_t i = 0; i < ids.size(); i++){
+
+        const size_t v = ids[i];
+        txt << v % X << " " << (v / X) % Y;
+        if(Stencil::dim == 3)
+            txt << " " << v / (X*Y);
+        for(int d = 0; d < Stencil::dim; d++)
+            txt << " " << field[v][d];
+        txt << "\n";
+    }
+    txt.close();
+
+    const string cells = base + ((Stencil::dim == 3) ? "_simplex.tet" : "_simplex.tri");
+    ofstream cell (cells.c_str());
+    for(int i = 0; i <= Stencil::dim; i++)
+        cell << (i ? " " : "") << (lower_bound(ids.begin(), ids.end(), simplex[i]) - ids.begin());
+    cell << "\n";
+    cell.close();
+
+    printf("   reproduce with: CriticalPointDetection%s %s.raw%s\n", trial.options.c_str(), base.c_str(), dims.c_str());
+    printf("              or: CriticalPointDetection %s_simplex.txt %s\n", base.c_str(), cells.c_str());
+}
+
+// -----------------------------------------------------------------------
+// returns the number of configurations that disagree with the reference
+template <typename Stencil>
+static size_t run_trial(Trial &trial, mt19937_64 &rng, size_t &nchecks) {
+
+    const int dim = Stencil::dim;
+
+    trial.dims.clear();
+    for(int a = 0; a < dim; a++)
+        trial.dims.push_back(2 + rng() % ((dim == 2) ? 9 : 5));
+
+    trial.periodic.assign(3, false);
+    string axes;
+    for(int a = 0; a < dim; a++){
+        trial.periodic[a] = (rng() % 4 == 0);
+        if(trial.periodic[a])
+            axes += "xyz"[a];
+
+        // the stencil must conform across the periodic axes
+        if(trial.periodic[a] && trial.dims[a] % Stencil::nparities != 0)
+            trial.dims[a]++;
+    }
+
+    trial.options.clear();
+    if(is_same<Stencil, Tet6>::value)
+        trial.options += " --stencil=6";
+    if(!axes.empty())
+        trial.options += " --periodic=" + axes;
+
+    StructuredGrid<Stencil> grid(trial.dims, trial.periodic);
+    const vector<vec> field = generate(trial.kind, grid.num_vertices(), dim, rng);
+
+    Config plain;
+    plain.filter = plain.sweep = plain.ranks = false;
+    plain.tile.assign(1, 0);
+    const vector<size_t> ref = detect(grid, field, plain);
+
+    vector<pair<string, vector<size_t> > > results;
+    Config config;
+
+    config = plain;     config.filter = true;
+    results.push_back(make_pair(string("filter"), detect(grid, field, config)));
+
+    if(dim == 2){
+        config = plain;     config.ranks = true;
+        results.push_back(make_pair(string("ranks"), detect(grid, field, config)));
+
+        config = plain;     config.sweep = true;
+        results.push_back(make_pair(string("edge sweep"), detect(grid, field, config)));
+    }
+
+    config = plain;     config.filter = true;
+    config.tile.clear();
+    for(int a = 0; a < 3; a++)
+        config.tile.push_back(1 + rng() % 3);
+    results.push_back(make_pair("tiles " + to_string(config.tile[0]) + "x" + to_string(config.tile[1]) + "x" + to_string(config.tile[2]),
+                                detect(grid, field, config)));
+
+    results.push_back(make_pair(string("default"), detect(grid, field, Config())));
+
+    vector<Vec<3,float> > ffield (field.size());
+    for(size_t v = 0; v < field.size(); v++)
+        for(int d = 0; d < dim; d++)
+            ffield[v][d] = float(field[v][d]);
+    results.push_back(make_pair(string("float32"), detect(grid, ffield, Config())));
+
+    results.push_back(make_pair(string("candidates"), detect_candidates(grid, field)));
+    results.push_back(make_pair(string("ensemble"), detect_ensemble(grid, field, rng)));
+    results.push_back(make_pair(string("targets"), detect_targets(grid, field, rng)));
+
+    // the first disagreement is reproduced, and the other configurations that disagree are listed
+    size_t nfailed = 0;
+    string others;
+    for(size_t i = 0; i < results.size(); i++){
+
+        if(results[i].second == ref)
+            continue;
+
+        if(nfailed == 0)
+            report(trial, results[i].first, ref, results[i].second, grid, field);
+        else
+            others += (nfailed > 1 ? ", " : "") + results[i].first;
+        nfailed++;
+    }
+    if(!others.empty())
+        printf("   also disagree: %s\n", others.c_str());
+
+    nchecks += results.size();
+    return nfailed;
+}
+
+size_t Validate::run(size_t ntrials) {
+
+    printf(" Validating the fast paths against the plain SoS path in %ld trials\n", ntrials);
+    fflush(stdout);
+
+    size_t nfailed = 0, nchecks = 0;
+    for(size_t t = 0; t < ntrials; t++){
+
+        mt19937_64 rng (t);
+
+        Trial trial;
+        trial.id = t;
+        trial.kind = Kind(t % NKINDS);
+
+        switch((t / NKINDS) % 3){
+            case 0:     nfailed += run_trial<Tri2>(trial, rng, nchecks);   break;
+            case 1:     nfailed += run_trial<Tet5>(trial, rng, nchecks);   break;
+            default:    nfailed += run_trial<Tet6>(trial, rng, nchecks);   break;
+        }
+    }
+
+    printf(" Done! %ld comparisons, %ld disagreements\n", nchecks, nfailed);
+    return nfailed;
+}